@@ -0,0 +1,279 @@
+// Per-frame bookkeeping of WorldManager: node based containers (std::map, std::set, std::list) vs slot maps.
+// Usage: bench_bookkeeping [--actors N] [--frames N] [--churn N] [--seed N]
+// Every frame evaluates and updates all of the actors, then removes and adds back churn of them.
+// Human readable results go to stderr, JSON goes to stdout.
+
+#include <array>
+#include <stdexcept>
+#include <initializer_list>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "core/BasicObjects.h"
+#include "helpers/Containers.hpp"
+
+namespace
+{
+    using namespace core::basic;
+    using helpers::containers::SlotHandle;
+    using helpers::containers::SlotMap;
+
+    class Actor :
+            public virtual object::InitializableObject,
+            public virtual object::UpdatableObject,
+            public virtual actor::Evaluate,
+            public virtual behavior::Position
+    {
+    public:
+        void initialize() override
+        {}
+        void evaluate(uint32_t time_elapsed) override
+        { _ticks += time_elapsed; }
+        bool update(bool force) override
+        { return force || changed(); }
+        uint64_t ticks() const
+        { return _ticks; }
+    private:
+        uint64_t _ticks{0};
+    };
+
+    struct UpdateInfo
+    {
+        actor::Update *actor;
+        object::Object *object;
+        behavior::Position *position;
+    };
+
+    struct Options
+    {
+        uint32_t actors{100000};
+        uint32_t frames{100};
+        uint32_t churn{1000};
+        uint32_t seed{1};
+    };
+
+    // What WorldManager kept before: lists ordered by id in tree nodes
+    class NodeBookkeeping
+    {
+    public:
+        void add(Actor *actor)
+        {
+            _initialization_list.push_back(actor);
+        }
+        void remove(Id id)
+        {
+            _death_note.insert(id);
+        }
+        uint64_t frame(uint32_t time_elapsed)
+        {
+            for (auto &actor: _initialization_list)
+            {
+                actor->initialize();
+                auto id = actor->unique_id();
+                _actors_to_evaluate[id] = actor;
+                _objects_to_update[id] = {actor, actor, actor};
+            }
+            _initialization_list.clear();
+            uint64_t checksum = 0;
+            for (auto &[id, actor]: _actors_to_evaluate)
+            {
+                actor->evaluate(time_elapsed);
+            }
+            for (auto &[id, update_info]: _objects_to_update)
+            {
+                checksum += update_info.actor->update(true) + update_info.position->position().x;
+            }
+            for (auto id: _death_note)
+            {
+                _actors_to_evaluate.erase(id);
+                _objects_to_update.erase(id);
+            }
+            _death_note.clear();
+            return checksum;
+        }
+    private:
+        std::list<Actor *> _initialization_list;
+        std::map<Id, actor::Evaluate *> _actors_to_evaluate;
+        std::map<Id, UpdateInfo> _objects_to_update;
+        std::set<Id> _death_note;
+    };
+
+    // What WorldManager keeps now: dense slot maps and one lookup by id for the removal
+    class DenseBookkeeping
+    {
+    public:
+        void add(Actor *actor)
+        {
+            _initialization_list.push_back(actor);
+        }
+        void remove(Id id)
+        {
+            _death_note.push_back(id);
+        }
+        uint64_t frame(uint32_t time_elapsed)
+        {
+            for (auto actor: _initialization_list)
+            {
+                actor->initialize();
+                auto &slots = _slots[actor->unique_id()];
+                slots.evaluate = _actors_to_evaluate.emplace(actor);
+                slots.update = _objects_to_update.emplace(UpdateInfo{actor, actor, actor});
+            }
+            _initialization_list.clear();
+            uint64_t checksum = 0;
+            for (size_t i = 0; i < _actors_to_evaluate.size(); ++i)
+            {
+                _actors_to_evaluate.value(i)->evaluate(time_elapsed);
+            }
+            for (auto &update_info: _objects_to_update)
+            {
+                checksum += update_info.actor->update(true) + update_info.position->position().x;
+            }
+            std::sort(_death_note.begin(), _death_note.end());
+            _death_note.erase(std::unique(_death_note.begin(), _death_note.end()), _death_note.end());
+            for (auto id: _death_note)
+            {
+                auto slots = _slots.find(id);
+                if (slots == _slots.end())
+                {
+                    continue;
+                }
+                _actors_to_evaluate.remove(slots->second.evaluate);
+                _objects_to_update.remove(slots->second.update);
+                _slots.erase(slots);
+            }
+            _death_note.clear();
+            return checksum;
+        }
+    private:
+        struct Slots
+        {
+            SlotHandle evaluate;
+            SlotHandle update;
+        };
+        std::vector<Actor *> _initialization_list;
+        SlotMap<actor::Evaluate *> _actors_to_evaluate;
+        SlotMap<UpdateInfo> _objects_to_update;
+        std::unordered_map<Id, Slots> _slots;
+        std::vector<Id> _death_note;
+    };
+
+    uint64_t ticks(const std::vector<std::unique_ptr<Actor>> &actors)
+    {
+        uint64_t result = 0;
+        for (const auto &actor: actors)
+        {
+            result += actor->ticks();
+        }
+        return result;
+    }
+
+    // Microseconds per frame, ticks the actors got in the run are added to checksum
+    template<class Bookkeeping>
+    double run(const Options &options, std::vector<std::unique_ptr<Actor>> &actors, uint64_t &checksum)
+    {
+        auto ticks_before = ticks(actors);
+        Bookkeeping bookkeeping;
+        for (auto &actor: actors)
+        {
+            bookkeeping.add(actor.get());
+        }
+        bookkeeping.frame(0);
+        std::mt19937 random(options.seed);
+        std::vector<Actor *> churned;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < options.frames; ++frame)
+        {
+            // NOTE: the same actors are added back, so the runs don't differ by allocations
+            for (auto actor: churned)
+            {
+                bookkeeping.add(actor);
+            }
+            churned.clear();
+            for (uint32_t i = 0; i < options.churn && !actors.empty(); ++i)
+            {
+                auto actor = actors[random() % actors.size()].get();
+                bookkeeping.remove(actor->unique_id());
+                churned.push_back(actor);
+            }
+            std::sort(churned.begin(), churned.end());
+            churned.erase(std::unique(churned.begin(), churned.end()), churned.end());
+            checksum += bookkeeping.frame(1);
+        }
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        checksum += ticks(actors) - ticks_before;
+        return seconds * 1e6 / std::max<uint32_t>(options.frames, 1);
+    }
+
+    bool parse(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            auto value = (uint32_t) std::stoul(argv[++i]);
+            if (arg == "--actors")
+            {
+                options.actors = value;
+            }
+            else if (arg == "--frames")
+            {
+                options.frames = value;
+            }
+            else if (arg == "--churn")
+            {
+                options.churn = value;
+            }
+            else if (arg == "--seed")
+            {
+                options.seed = value;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        std::fprintf(stderr, "Usage: %s [--actors N] [--frames N] [--churn N] [--seed N]\n", argv[0]);
+        return 1;
+    }
+    std::vector<std::unique_ptr<Actor>> actors;
+    for (uint32_t i = 0; i < options.actors; ++i)
+    {
+        actors.emplace_back(new Actor);
+    }
+    uint64_t checksum_before = 0;
+    uint64_t checksum_after = 0;
+    auto before = run<NodeBookkeeping>(options, actors, checksum_before);
+    auto after = run<DenseBookkeeping>(options, actors, checksum_after);
+    if (checksum_before != checksum_after)
+    {
+        std::fprintf(stderr, "Checksums differ: %llu vs %llu\n", (unsigned long long) checksum_before,
+                     (unsigned long long) checksum_after);
+        return 1;
+    }
+    std::fprintf(stderr, "actors %u, churn %u: node containers %.1f us/frame, slot maps %.1f us/frame (x%.2f)\n",
+                 options.actors, options.churn, before, after, after > 0. ? before / after : 0.);
+    std::printf("{\"actors\": %u, \"churn\": %u, \"frames\": %u, \"node_us_per_frame\": %.2f, "
+                "\"dense_us_per_frame\": %.2f}\n", options.actors, options.churn, options.frames, before, after);
+    return 0;
+}
@@ -0,0 +1,824 @@
+// Collision detector benchmarks, no window needed.
+// Usage: bench_collision [--objects N] [--frames N] [--seed N] [--suite NAME] [--json PATH]
+// Human readable results go to stderr, JSON goes to stdout (or to the --json file).
+
+#include <array>
+#include <stdexcept>
+#include <initializer_list>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "core/CollisionDetectors.hpp"
+#include "helpers/AABBKernel.h"
+#include "helpers/ThreadPool.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    std::atomic<uint64_t> allocations{0};
+    // Bytes allocated and not freed yet, the size of a block is kept in front of it
+    std::atomic<int64_t> live_bytes{0};
+    constexpr size_t block_header = alignof(std::max_align_t);
+    // NOTE: called through pointers the compiler can't see through, so code inlining operator delete doesn't get
+    // a free() of memory from operator new (-Wmismatched-new-delete)
+    void *(*volatile allocate)(size_t) = std::malloc;
+    void (*volatile deallocate)(void *) = std::free;
+
+    void release(void *ptr) noexcept
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+        auto block = static_cast<char *>(ptr) - block_header;
+        live_bytes.fetch_sub((int64_t) *reinterpret_cast<size_t *>(block), std::memory_order_relaxed);
+        deallocate(block);
+    }
+}
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto block = static_cast<char *>(allocate(size + block_header)))
+    {
+        *reinterpret_cast<size_t *>(block) = size;
+        live_bytes.fetch_add((int64_t) size, std::memory_order_relaxed);
+        return block + block_header;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    release(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    release(ptr);
+}
+
+namespace
+{
+    using namespace core::collision_detector;
+    using namespace core::basic::behavior;
+
+    class Object :
+            public virtual UniqueId<Id>,
+            public virtual CollisionShape<AABB>
+    {
+    };
+
+    struct Options
+    {
+        uint32_t objects{10000};
+        uint32_t frames{30};
+        uint32_t seed{1};
+        std::string suite;
+        std::string json;
+    };
+
+    enum class Workload
+    {
+        Uniform,
+        Clustered,
+        MixedSizes,
+        StaticHeavy,
+        AllMoving
+    };
+
+    const char *workload_name(Workload workload)
+    {
+        switch (workload)
+        {
+            case Workload::Uniform:
+                return "uniform";
+            case Workload::Clustered:
+                return "clustered";
+            case Workload::MixedSizes:
+                return "mixed_sizes";
+            case Workload::StaticHeavy:
+                return "static_heavy";
+            case Workload::AllMoving:
+                return "all_moving";
+        }
+        return "unknown";
+    }
+
+    // Seeded scene: same options give the same objects and the same moves for every detector
+    class Scene
+    {
+    public:
+        // world 0 keeps about the same density for any amount of objects
+        Scene(Workload workload, uint32_t objects, uint32_t seed, uint32_t world = 0)
+                :
+                _random(seed)
+        {
+            _world = world != 0 ? world : std::max<uint32_t>(1024, (uint32_t) (std::sqrt((double) objects) * 64));
+            _moving = workload == Workload::AllMoving ? 1.f : 0.25f;
+            std::uniform_real_distribution<float> position(0.f, (float) _world);
+            std::normal_distribution<float> spread(0.f, _world / 40.f);
+            std::vector<PointF> clusters;
+            for (int i = 0; i < 16; ++i)
+            {
+                clusters.emplace_back(position(_random), position(_random));
+            }
+            for (uint32_t i = 0; i < objects; ++i)
+            {
+                auto object = std::make_unique<Object>();
+                uint32_t size = 4 + _random() % 28;
+                if (workload == Workload::MixedSizes)
+                {
+                    auto kind = _random() % 100;
+                    size = kind < 90 ? 4 + _random() % 12 : (kind < 99 ? 32 + _random() % 96 : 256 + _random() % 768);
+                }
+                PointF center(position(_random), position(_random));
+                if (workload == Workload::Clustered)
+                {
+                    const auto &cluster = clusters[_random() % clusters.size()];
+                    center = PointF(cluster.x + spread(_random), cluster.y + spread(_random));
+                }
+                object->set_static_shape(workload == Workload::StaticHeavy && i % 10 != 0);
+                object->set_collision_shape(place(center, size));
+                _velocities.emplace_back((float) ((int) (_random() % 9) - 4), (float) ((int) (_random() % 9) - 4));
+                _objects.push_back(std::move(object));
+            }
+        }
+
+        uint32_t world() const
+        { return _world; }
+
+        const std::vector<std::unique_ptr<Object>> &objects() const
+        { return _objects; }
+
+        std::mt19937 &random()
+        { return _random; }
+
+        // Moves a part of the dynamic objects, ids of the moved ones are put to moved
+        void step(std::vector<Id> &moved)
+        {
+            moved.clear();
+            for (size_t i = 0; i < _objects.size(); ++i)
+            {
+                auto &object = *_objects[i];
+                if (object.is_static_shape() || (_moving < 1.f && (_random() % 1000) >= _moving * 1000))
+                {
+                    continue;
+                }
+                const auto &shape = object.collision_shape();
+                auto &velocity = _velocities[i];
+                PointF center((shape.top_left.x + shape.bottom_right.x) / 2.f + velocity.x,
+                              (shape.top_left.y + shape.bottom_right.y) / 2.f + velocity.y);
+                if (center.x <= 0.f || center.x >= _world)
+                {
+                    velocity.x = -velocity.x;
+                }
+                if (center.y <= 0.f || center.y >= _world)
+                {
+                    velocity.y = -velocity.y;
+                }
+                object.set_collision_shape(place(center, shape.width()));
+                moved.push_back(object.unique_id());
+            }
+        }
+
+    private:
+        AABB place(const PointF &center, uint32_t size) const
+        {
+            auto fit = [this](float value)
+            {
+                return (uint32_t) std::clamp(value, 0.f, (float) _world);
+            };
+            auto half = size / 2.f;
+            return AABB(fit(center.y - half), fit(center.x - half), fit(center.y + half), fit(center.x + half));
+        }
+
+        std::mt19937 _random;
+        uint32_t _world{0};
+        float _moving{0.f};
+        std::vector<std::unique_ptr<Object>> _objects;
+        std::vector<PointF> _velocities;
+    };
+
+    // Hardware cache misses of this thread, where perf events are available
+    class CacheMisses
+    {
+    public:
+        CacheMisses()
+        {
+#ifdef __linux__
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            _fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        }
+        ~CacheMisses()
+        {
+#ifdef __linux__
+            if (_fd >= 0)
+            {
+                close(_fd);
+            }
+#endif
+        }
+        CacheMisses(const CacheMisses &) = delete;
+        CacheMisses &operator=(const CacheMisses &) = delete;
+        bool available() const
+        { return _fd >= 0; }
+        uint64_t read() const
+        {
+            uint64_t value = 0;
+#ifdef __linux__
+            if (_fd >= 0 && ::read(_fd, &value, sizeof(value)) != sizeof(value))
+            {
+                value = 0;
+            }
+#endif
+            return value;
+        }
+    private:
+        int _fd{-1};
+    };
+
+    // Totals of one measured operation, may be collected over several frames
+    struct Sample
+    {
+        uint64_t ops{0};
+        double seconds{0.};
+        uint64_t allocations{0};
+        uint64_t cache_misses{0};
+    };
+
+    using Extra = std::vector<std::pair<std::string, double>>;
+
+    struct Result
+    {
+        std::string suite;
+        std::string detector;
+        std::string workload;
+        std::string op;
+        Sample sample;
+        Extra extra;
+    };
+
+    class Bench
+    {
+    public:
+        explicit Bench(const Options &options)
+                :
+                _options(options)
+        {}
+
+        const Options &options() const
+        { return _options; }
+
+        bool enabled(const char *suite) const
+        { return _options.suite.empty() || _options.suite == suite; }
+
+        // Adds time, allocations and cache misses of function to sample, function returns the amount of ops
+        template<class Function>
+        void measure(Sample &sample, Function function)
+        {
+            auto allocations_before = allocations.load(std::memory_order_relaxed);
+            auto misses_before = _misses.read();
+            auto start = std::chrono::steady_clock::now();
+            sample.ops += function();
+            auto finish = std::chrono::steady_clock::now();
+            sample.cache_misses += _misses.read() - misses_before;
+            sample.allocations += allocations.load(std::memory_order_relaxed) - allocations_before;
+            sample.seconds += std::chrono::duration<double>(finish - start).count();
+        }
+
+        Result &report(const std::string &suite, const std::string &detector, Workload workload, const char *op,
+                       const Sample &sample, Extra extra = {})
+        {
+            _results.push_back({suite, detector, workload_name(workload), op, sample, std::move(extra)});
+            print(_results.back());
+            return _results.back();
+        }
+
+        template<class Function>
+        Result &report(const std::string &suite, const std::string &detector, Workload workload, const char *op,
+                       Function function)
+        {
+            Sample sample;
+            measure(sample, function);
+            return report(suite, detector, workload, op, sample);
+        }
+
+        void write_json(FILE *file) const
+        {
+            static const char *simd_levels[] = {"scalar", "sse2", "avx2"};
+            std::fprintf(file, "{\n  \"objects\": %u,\n  \"frames\": %u,\n  \"seed\": %u,\n  \"simd\": \"%s\",\n",
+                         _options.objects, _options.frames, _options.seed,
+                         simd_levels[(int) helpers::containers::simd_level()]);
+            std::fprintf(file, "  \"results\": [\n");
+            for (size_t i = 0; i < _results.size(); ++i)
+            {
+                const auto &result = _results[i];
+                const auto &sample = result.sample;
+                auto ops = (double) std::max<uint64_t>(sample.ops, 1);
+                std::fprintf(file, "    {\"suite\": \"%s\", \"detector\": \"%s\", \"workload\": \"%s\", \"op\": \"%s\", "
+                                   "\"ops\": %llu, \"ns_per_op\": %.2f, \"ops_per_second\": %.1f, "
+                                   "\"allocations_per_op\": %.4f, \"cache_misses_per_op\": ",
+                             result.suite.c_str(), result.detector.c_str(), result.workload.c_str(), result.op.c_str(),
+                             (unsigned long long) sample.ops, sample.seconds * 1e9 / ops,
+                             sample.seconds > 0. ? sample.ops / sample.seconds : 0., sample.allocations / ops);
+                if (_misses.available())
+                {
+                    std::fprintf(file, "%.4f", sample.cache_misses / ops);
+                }
+                else
+                {
+                    std::fprintf(file, "null");
+                }
+                for (const auto &[name, value]: result.extra)
+                {
+                    std::fprintf(file, ", \"%s\": %.4f", name.c_str(), value);
+                }
+                std::fprintf(file, "}%s\n", i + 1 < _results.size() ? "," : "");
+            }
+            std::fprintf(file, "  ]\n}\n");
+        }
+
+    private:
+        void print(const Result &result) const
+        {
+            const auto &sample = result.sample;
+            auto ops = (double) std::max<uint64_t>(sample.ops, 1);
+            std::fprintf(stderr, "%-10s %-24s %-13s %-12s %12.1f ns/op %10.4f allocs/op", result.suite.c_str(),
+                         result.detector.c_str(), result.workload.c_str(), result.op.c_str(),
+                         sample.seconds * 1e9 / ops, sample.allocations / ops);
+            if (_misses.available())
+            {
+                std::fprintf(stderr, " %10.2f misses/op", sample.cache_misses / ops);
+            }
+            for (const auto &[name, value]: result.extra)
+            {
+                std::fprintf(stderr, " %s %.0f", name.c_str(), value);
+            }
+            std::fprintf(stderr, "\n");
+        }
+
+        Options _options;
+        CacheMisses _misses;
+        std::vector<Result> _results;
+    };
+
+    template<class Detector>
+    void set_world(Detector &detector, uint32_t world)
+    {
+        detector.set_world_size({world, world});
+    }
+
+    // Full detector life: add, frames of moves with queries and pairs, remove
+    template<class Detector, class Setup>
+    void run_detector(Bench &bench, const char *suite, const std::string &name, Workload workload, Setup setup)
+    {
+        const auto &options = bench.options();
+        Scene scene(workload, options.objects, options.seed);
+        Detector detector;
+        set_world(detector, scene.world());
+        setup(detector);
+        // NOTE: enabled before the objects are added, the way BasicContext runs it
+        detector.set_pair_cache(true);
+        typename Detector::IdBuffer found;
+        typename Detector::PairBuffer pairs;
+        std::vector<Id> moved;
+
+        bench.report(suite, name, workload, "add", [&]()
+        {
+            std::vector<const Object *> statics;
+            for (const auto &object: scene.objects())
+            {
+                if (object->is_static_shape())
+                {
+                    statics.push_back(object.get());
+                }
+                else
+                {
+                    detector.add(*object);
+                }
+            }
+            detector.add_static(statics);
+            return (uint64_t) scene.objects().size();
+        });
+        // an empty or stale cache would make update_pairs look free
+        auto check_pairs = [&]()
+        {
+            detector.broad_check(pairs);
+            const auto &cached = detector.pairs();
+            if (!std::equal(cached.begin(), cached.end(), pairs.begin(), pairs.end()))
+            {
+                throw std::runtime_error(name + ": cached pairs differ from broad_check()");
+            }
+        };
+        detector.update_pairs();
+        check_pairs();
+        // moves are made outside of the measured parts
+        std::vector<std::vector<Id>> frames;
+        std::vector<std::vector<AABB>> shapes;
+        for (uint32_t frame = 0; frame < options.frames; ++frame)
+        {
+            scene.step(moved);
+            frames.push_back(moved);
+            shapes.emplace_back();
+            for (const auto &object: scene.objects())
+            {
+                shapes.back().push_back(object->collision_shape());
+            }
+        }
+        auto apply = [&](uint32_t frame)
+        {
+            for (size_t i = 0; i < scene.objects().size(); ++i)
+            {
+                const_cast<Object &>(*scene.objects()[i]).set_collision_shape(shapes[frame][i]);
+            }
+        };
+        std::vector<AABB> regions;
+        std::vector<Point> points;
+        for (int i = 0; i < 256; ++i)
+        {
+            uint32_t x = scene.random()() % scene.world();
+            uint32_t y = scene.random()() % scene.world();
+            regions.emplace_back(y, x, y + 64, x + 64);
+            points.emplace_back(scene.random()() % scene.world(), scene.random()() % scene.world());
+        }
+        Sample update, query, pair, cache;
+        for (uint32_t frame = 0; frame < options.frames; ++frame)
+        {
+            apply(frame);
+            bench.measure(update, [&]()
+            {
+                detector.update(frames[frame]);
+                return (uint64_t) frames[frame].size();
+            });
+            bench.measure(query, [&]()
+            {
+                for (size_t i = 0; i < regions.size(); ++i)
+                {
+                    detector.broad_check(regions[i], found);
+                    detector.broad_check(points[i], found);
+                }
+                return (uint64_t) regions.size() * 2;
+            });
+            bench.measure(pair, [&]()
+            {
+                detector.broad_check(pairs);
+                return (uint64_t) 1;
+            });
+            bench.measure(cache, [&]()
+            {
+                detector.update_pairs();
+                return (uint64_t) 1;
+            });
+        }
+        check_pairs();
+        bench.report(suite, name, workload, "update", update);
+        bench.report(suite, name, workload, "query", query);
+        bench.report(suite, name, workload, "pairs", pair, {{"pairs", pairs.size()}});
+        bench.report(suite, name, workload, "update_pairs", cache);
+        bench.report(suite, name, workload, "remove", [&]()
+        {
+            for (const auto &object: scene.objects())
+            {
+                detector.remove(*object);
+            }
+            return (uint64_t) scene.objects().size();
+        });
+    }
+
+    template<class Detector>
+    void run_detector(Bench &bench, const char *suite, const std::string &name, Workload workload)
+    {
+        run_detector<Detector>(bench, suite, name, workload, [](Detector &)
+        {});
+    }
+
+    using Grid = HierarchicalSpatialGrid<Object, CollisionShape, FlatCell>;
+
+    void workloads(Bench &bench)
+    {
+        for (auto workload: {Workload::Uniform, Workload::Clustered, Workload::MixedSizes, Workload::StaticHeavy,
+                             Workload::AllMoving})
+        {
+            run_detector<Grid>(bench, "workloads", "grid", workload);
+        }
+    }
+
+    void cells(Bench &bench)
+    {
+        for (auto workload: {Workload::Uniform, Workload::Clustered})
+        {
+            run_detector<HierarchicalSpatialGrid<Object, CollisionShape, OrderedCell, DenseGrid>>(
+                    bench, "cells", "grid_ordered_dense", workload);
+            run_detector<HierarchicalSpatialGrid<Object, CollisionShape, FlatCell, DenseGrid>>(
+                    bench, "cells", "grid_flat_dense", workload);
+            run_detector<HierarchicalSpatialGrid<Object, CollisionShape, OrderedCell, SparseGrid>>(
+                    bench, "cells", "grid_ordered_sparse", workload);
+            run_detector<HierarchicalSpatialGrid<Object, CollisionShape, FlatCell, SparseGrid>>(
+                    bench, "cells", "grid_flat_sparse", workload);
+        }
+    }
+
+    void detectors(Bench &bench)
+    {
+        for (auto workload: {Workload::Uniform, Workload::Clustered, Workload::MixedSizes, Workload::AllMoving})
+        {
+            run_detector<Grid>(bench, "detectors", "grid", workload);
+            run_detector<SweepAndPrune<Object>>(bench, "detectors", "sweep_and_prune", workload);
+            run_detector<DynamicAABBTree<Object>>(bench, "detectors", "aabb_tree", workload);
+        }
+    }
+
+    void threads(Bench &bench)
+    {
+        std::vector<uint32_t> sizes{1, 2, 4};
+        auto hardware = std::thread::hardware_concurrency();
+        if (hardware > 4)
+        {
+            sizes.push_back(hardware);
+        }
+        for (auto size: sizes)
+        {
+            helpers::threading::ThreadPool pool(size);
+            run_detector<Grid>(bench, "threads", "grid_threads_" + std::to_string(size), Workload::Uniform,
+                               [&pool](Grid &grid)
+                               {
+                                   grid.set_thread_pool(&pool);
+                               });
+        }
+    }
+
+    void layout(Bench &bench)
+    {
+        for (auto workload: {Workload::Uniform, Workload::AllMoving})
+        {
+            run_detector<Grid>(bench, "layout", "grid", workload);
+            run_detector<Grid>(bench, "layout", "grid_morton_8", workload, [](Grid &grid)
+            {
+                grid.set_morton_order(8);
+            });
+            run_detector<Grid>(bench, "layout", "grid_loose_1.5", workload, [](Grid &grid)
+            {
+                grid.set_looseness(1.5f);
+            });
+            run_detector<Grid>(bench, "layout", "grid_auto_tune", workload, [](Grid &grid)
+            {
+                grid.set_auto_tune(true);
+            });
+        }
+    }
+
+    // Heap bytes and cells held by the grid after adding the scene, measured while the grid is alive
+    template<class Detector>
+    void run_memory(Bench &bench, const std::string &name, uint32_t world)
+    {
+        const auto &options = bench.options();
+        Scene scene(Workload::Uniform, options.objects, options.seed, world);
+        auto bytes_before = live_bytes.load(std::memory_order_relaxed);
+        Detector detector;
+        set_world(detector, world);
+        Sample sample;
+        bench.measure(sample, [&]()
+        {
+            for (const auto &object: scene.objects())
+            {
+                detector.add(*object);
+            }
+            return (uint64_t) scene.objects().size();
+        });
+        auto bytes = live_bytes.load(std::memory_order_relaxed) - bytes_before;
+        bench.report("memory", name, Workload::Uniform, "add", sample,
+                     {{"world",       world},
+                      {"bytes",       (double) bytes},
+                      {"cells",       detector.cell_count()},
+                      {"world_cells", detector.world_cells()}});
+    }
+
+    void memory(Bench &bench)
+    {
+        using Dense = HierarchicalSpatialGrid<Object, CollisionShape, FlatCell, DenseGrid>;
+        using Sparse = HierarchicalSpatialGrid<Object, CollisionShape, FlatCell, SparseGrid>;
+        // NOTE: DenseGrid of a 1M x 1M world needs about 10^9 cells for small objects, it is not run there;
+        // world_cells of the sparse grid is what the dense one would hold
+        constexpr uint32_t dense_limit = 32768;
+        for (uint32_t world: {4096u, 32768u, 1048576u})
+        {
+            auto suffix = "_" + std::to_string(world);
+            if (world <= dense_limit)
+            {
+                run_memory<Dense>(bench, "grid_dense" + suffix, world);
+            }
+            run_memory<Sparse>(bench, "grid_sparse" + suffix, world);
+        }
+    }
+
+    // What callers did before nearest(): a square region query, then distances and the sort by hand.
+    // The square grows until the k-th distance fits into it, so the result is the same.
+    template<class Detector>
+    void nearest_by_hand(const Detector &detector, const Point &pt, uint32_t k, typename Detector::Neighbours &result)
+    {
+        auto axis = [](uint32_t value, uint32_t low, uint32_t high) -> uint64_t
+        {
+            return value < low ? low - value : (value > high ? value - high : 0);
+        };
+        auto closer = [](const auto &a, const auto &b)
+        {
+            return a.distance < b.distance || (a.distance == b.distance && a.id < b.id);
+        };
+        for (uint64_t radius = 16;; radius *= 2)
+        {
+            Rect square((uint32_t) (pt.y > radius ? pt.y - radius : 0), (uint32_t) (pt.x > radius ? pt.x - radius : 0),
+                        (uint32_t) std::min<uint64_t>(pt.y + radius, UINT32_MAX),
+                        (uint32_t) std::min<uint64_t>(pt.x + radius, UINT32_MAX));
+            auto found = detector.broad_check(square);
+            result.clear();
+            for (auto id: found)
+            {
+                const auto &shape = detector.object(id)->collision_shape();
+                auto dx = axis(pt.x, shape.top_left.x, shape.bottom_right.x);
+                auto dy = axis(pt.y, shape.top_left.y, shape.bottom_right.y);
+                result.push_back({id, std::sqrt((float) (dx * dx + dy * dy))});
+            }
+            auto count = std::min<size_t>(k, result.size());
+            std::partial_sort(result.begin(), result.begin() + count, result.end(), closer);
+            result.resize(count);
+            if (found.size() >= detector.size() || radius > UINT32_MAX ||
+                (count == k && result.back().distance <= (float) radius))
+            {
+                return;
+            }
+        }
+    }
+
+    // Every agent looks for its nearest neighbours every frame
+    template<class Detector, class Nearest>
+    void run_knn(Bench &bench, const std::string &name, Nearest nearest)
+    {
+        constexpr uint32_t agents = 5000;
+        constexpr uint32_t k = 8;
+        const auto &options = bench.options();
+        Scene scene(Workload::AllMoving, agents, options.seed);
+        Detector detector;
+        set_world(detector, scene.world());
+        for (const auto &object: scene.objects())
+        {
+            detector.add(*object);
+        }
+        typename Detector::Neighbours neighbours;
+        std::vector<Id> moved;
+        Sample sample;
+        uint64_t found = 0;
+        auto first = scene.objects().front()->unique_id();
+        for (uint32_t frame = 0; frame < options.frames; ++frame)
+        {
+            scene.step(moved);
+            detector.update(moved);
+            bench.measure(sample, [&]()
+            {
+                for (const auto &object: scene.objects())
+                {
+                    const auto &shape = object->collision_shape();
+                    nearest(detector, Point((shape.top_left.x + shape.bottom_right.x) / 2,
+                                            (shape.top_left.y + shape.bottom_right.y) / 2), k, neighbours);
+                    for (const auto &neighbour: neighbours)
+                    {
+                        found += neighbour.id - first;
+                    }
+                }
+                return (uint64_t) agents;
+            });
+        }
+        bench.report("knn", name, Workload::AllMoving, "nearest_8", sample);
+        // NOTE: sum of the found ids (from the first one of the scene), the same for every detector
+        std::fprintf(stderr, "%-10s %-24s %-13s found %llu\n", "knn", name.c_str(), workload_name(Workload::AllMoving),
+                     (unsigned long long) found);
+    }
+
+    template<class Detector>
+    void run_knn(Bench &bench, const std::string &name)
+    {
+        run_knn<Detector>(bench, name, [](const Detector &detector, const Point &pt, uint32_t k,
+                                          typename Detector::Neighbours &result)
+        {
+            detector.nearest(pt, k, result);
+        });
+    }
+
+    void knn(Bench &bench)
+    {
+        run_knn<Grid>(bench, "grid_by_hand", nearest_by_hand<Grid>);
+        run_knn<Grid>(bench, "grid");
+        run_knn<SweepAndPrune<Object>>(bench, "sweep_and_prune");
+        run_knn<DynamicAABBTree<Object>>(bench, "aabb_tree");
+    }
+
+    bool parse(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            std::string value = argv[++i];
+            if (arg == "--objects")
+            {
+                options.objects = (uint32_t) std::stoul(value);
+            }
+            else if (arg == "--frames")
+            {
+                options.frames = (uint32_t) std::stoul(value);
+            }
+            else if (arg == "--seed")
+            {
+                options.seed = (uint32_t) std::stoul(value);
+            }
+            else if (arg == "--suite")
+            {
+                options.suite = value;
+            }
+            else if (arg == "--json")
+            {
+                options.json = value;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        std::fprintf(stderr, "Usage: %s [--objects N] [--frames N] [--seed N] "
+                             "[--suite workloads|cells|detectors|threads|layout|knn|memory] [--json PATH]\n",
+                     argv[0]);
+        return 1;
+    }
+    Bench bench(options);
+    const std::pair<const char *, void (*)(Bench &)> suites[] = {
+            {"workloads", workloads},
+            {"cells",     cells},
+            {"detectors", detectors},
+            {"threads",   threads},
+            {"layout",    layout},
+            {"knn",       knn},
+            {"memory",    memory}
+    };
+    try
+    {
+        for (const auto &[name, suite]: suites)
+        {
+            if (bench.enabled(name))
+            {
+                suite(bench);
+            }
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    FILE *file = options.json.empty() ? stdout : std::fopen(options.json.c_str(), "w");
+    if (file == nullptr)
+    {
+        std::fprintf(stderr, "Can't open %s\n", options.json.c_str());
+        return 1;
+    }
+    bench.write_json(file);
+    if (file != stdout)
+    {
+        std::fclose(file);
+    }
+    return 0;
+}
@@ -0,0 +1,229 @@
+// Per-frame object dispatch of WorldManager: RTTI casts on every frame vs pointers captured once.
+// NOTE: both sides walk and look up the same std::map, so only the casts differ.
+// Usage: bench_dispatch [--objects N] [--frames N] [--pairs N] [--seed N]
+// Human readable results go to stderr, JSON goes to stdout.
+
+#include <array>
+#include <stdexcept>
+#include <initializer_list>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include "core/BasicObjects.h"
+
+namespace
+{
+    using namespace core::basic;
+
+    // Same set of bases as the usual moving object of a game
+    class Unit :
+            public virtual object::CollidableObject,
+            public virtual object::UpdatableObject
+    {
+    public:
+        void initialize() override
+        {}
+        bool update(bool force) override
+        { return force || changed(); }
+    };
+
+    class Decoration :
+            public virtual object::UpdatableObject,
+            public virtual behavior::Position
+    {
+    public:
+        bool update(bool force) override
+        { return force || changed(); }
+    };
+
+    struct Options
+    {
+        uint32_t objects{50000};
+        uint32_t frames{100};
+        uint32_t pairs{20000};
+        uint32_t seed{1};
+    };
+
+    // Capabilities are captured once, as add_object() does, and kept next to the object
+    struct Entry
+    {
+        std::unique_ptr<object::Object> item;
+        object::CollidableObject *collidable{nullptr};
+        behavior::Position *position{nullptr};
+    };
+
+    struct Scene
+    {
+        std::map<Id, Entry> objects;
+        std::vector<std::pair<Id, Id>> pairs;
+    };
+
+    // What WorldManager did every frame: clear_collisions, update_objects and process_collisions cast each time
+    uint64_t frame_with_casts(Scene &scene)
+    {
+        uint64_t checksum = 0;
+        for (auto &[id, entry]: scene.objects)
+        {
+            auto collidable = dynamic_cast<object::CollidableObject *>(entry.item.get());
+            if (collidable != nullptr)
+            {
+                collidable->clear_collisions();
+            }
+        }
+        for (auto &[id, entry]: scene.objects)
+        {
+            auto position = dynamic_cast<behavior::Position *>(entry.item.get());
+            if (position != nullptr)
+            {
+                checksum += position->position().x;
+            }
+        }
+        for (const auto &[id1, id2]: scene.pairs)
+        {
+            auto obj1 = dynamic_cast<object::CollidableObject *>(scene.objects.at(id1).item.get());
+            auto obj2 = dynamic_cast<object::CollidableObject *>(scene.objects.at(id2).item.get());
+            checksum += (obj1 != nullptr) + (obj2 != nullptr);
+        }
+        return checksum;
+    }
+
+    void capture(Scene &scene)
+    {
+        for (auto &[id, entry]: scene.objects)
+        {
+            entry.collidable = dynamic_cast<object::CollidableObject *>(entry.item.get());
+            entry.position = dynamic_cast<behavior::Position *>(entry.item.get());
+        }
+    }
+
+    uint64_t frame_with_captured(Scene &scene)
+    {
+        uint64_t checksum = 0;
+        for (auto &[id, entry]: scene.objects)
+        {
+            if (entry.collidable != nullptr)
+            {
+                entry.collidable->clear_collisions();
+            }
+        }
+        for (auto &[id, entry]: scene.objects)
+        {
+            if (entry.position != nullptr)
+            {
+                checksum += entry.position->position().x;
+            }
+        }
+        for (const auto &[id1, id2]: scene.pairs)
+        {
+            auto obj1 = scene.objects.at(id1).collidable;
+            auto obj2 = scene.objects.at(id2).collidable;
+            checksum += (obj1 != nullptr) + (obj2 != nullptr);
+        }
+        return checksum;
+    }
+
+    template<class Function>
+    double measure(uint32_t frames, uint64_t &checksum, Function function)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t frame = 0; frame < frames; ++frame)
+        {
+            checksum += function();
+        }
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return seconds * 1e6 / std::max<uint32_t>(frames, 1);
+    }
+
+    bool parse(int argc, char **argv, Options &options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            auto value = (uint32_t) std::stoul(argv[++i]);
+            if (arg == "--objects")
+            {
+                options.objects = value;
+            }
+            else if (arg == "--frames")
+            {
+                options.frames = value;
+            }
+            else if (arg == "--pairs")
+            {
+                options.pairs = value;
+            }
+            else if (arg == "--seed")
+            {
+                options.seed = value;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parse(argc, argv, options))
+    {
+        std::fprintf(stderr, "Usage: %s [--objects N] [--frames N] [--pairs N] [--seed N]\n", argv[0]);
+        return 1;
+    }
+    std::mt19937 random(options.seed);
+    Scene scene;
+    std::vector<Id> ids;
+    for (uint32_t i = 0; i < options.objects; ++i)
+    {
+        std::unique_ptr<object::Object> item;
+        // NOTE: every fourth object is not collidable, so the casts fail sometimes as they do in a game
+        if (i % 4 == 3)
+        {
+            item.reset(new Decoration);
+        }
+        else
+        {
+            item.reset(new Unit);
+        }
+        ids.push_back(item->unique_id());
+        scene.objects[item->unique_id()].item = std::move(item);
+    }
+    for (uint32_t i = 0; i < options.pairs && !ids.empty(); ++i)
+    {
+        scene.pairs.emplace_back(ids[random() % ids.size()], ids[random() % ids.size()]);
+    }
+    uint64_t checksum_before = 0;
+    uint64_t checksum_after = 0;
+    auto before = measure(options.frames, checksum_before, [&scene]()
+    {
+        return frame_with_casts(scene);
+    });
+    capture(scene);
+    auto after = measure(options.frames, checksum_after, [&scene]()
+    {
+        return frame_with_captured(scene);
+    });
+    if (checksum_before != checksum_after)
+    {
+        std::fprintf(stderr, "Checksums differ: %llu vs %llu\n", (unsigned long long) checksum_before,
+                     (unsigned long long) checksum_after);
+        return 1;
+    }
+    std::fprintf(stderr, "objects %u, pairs %u: with casts %.1f us/frame, captured %.1f us/frame (x%.2f)\n",
+                 options.objects, options.pairs, before, after, after > 0. ? before / after : 0.);
+    std::printf("{\"objects\": %u, \"pairs\": %u, \"frames\": %u, \"casts_us_per_frame\": %.2f, "
+                "\"captured_us_per_frame\": %.2f}\n", options.objects, options.pairs, options.frames, before, after);
+    return 0;
+}
@@ -15,6 +15,13 @@ namespace core::basic::actor
         virtual void evaluate(uint32_t time_elapsed) = 0;
     };
 
+    // Evaluated on several threads at once together with the other parallel-safe actors, so evaluate() should
+    // change the actor itself only. Creating and removing objects is deferred, see WorldManager::defer(), so
+    // WorldManager::create_object() returns nullptr there.
+    class ParallelSafe: public virtual Evaluate
+    {
+    };
+
     class Update: public virtual IActor
     {
     public:
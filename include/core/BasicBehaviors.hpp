@@ -1,7 +1,9 @@
 #ifndef ENGINE_BASICBEHAVIORS_HPP
 #define ENGINE_BASICBEHAVIORS_HPP
 
+#include <optional>
 #include "core/Types.h"
+#include "core/NarrowPhase.h"
 #include "UniqueIdGenerator.hpp"
 #include "helpers/Containers.hpp"
 
@@ -45,10 +47,41 @@ namespace core::basic::behavior
         bool _static{false};
     };
 
+    // Fast shapes are swept between updates, so they do not tunnel through thin objects
+    class FastShape : public virtual IBehavior
+    {
+    public:
+        bool is_fast_shape() const;
+        void set_fast_shape(bool fast_shape);
+    private:
+        bool _fast{false};
+    };
+
+    class Changed;
+
+    // Objects collide only if the layer of each one is in the mask of the other
+    class CollisionFilter : public virtual IBehavior
+    {
+    public:
+        uint32_t collision_layer() const;
+        void set_collision_layer(uint32_t layer);
+        uint32_t collision_mask() const;
+        void set_collision_mask(uint32_t mask);
+        // NOTE: detectors keep a copy of the filter, the setters mark changed as changed,
+        // so the object gets updated in the broad phase even if it does not move
+        void track_changes(Changed *changed);
+    private:
+        uint32_t _layer{1};
+        uint32_t _mask{0xFFFFFFFF};
+        Changed *_changed{nullptr};
+    };
+
     template<class Shape>
     class CollisionShape :
             public virtual IBehavior,
-            public virtual StaticShape
+            public virtual StaticShape,
+            public virtual FastShape,
+            public virtual CollisionFilter
     {
     public:
         using collision_shape_type = Shape;
@@ -60,6 +93,18 @@ namespace core::basic::behavior
         collision_shape_type _collision_shape;
     };
 
+    // Exact shape for the narrow phase, the collision shape is used as it is when there is none
+    class NarrowShape : public virtual IBehavior
+    {
+    public:
+        using narrow_shape_type = narrow_phase::Shape;
+        const narrow_shape_type *narrow_shape() const;
+        void set_narrow_shape(const narrow_shape_type &shape);
+        void reset_narrow_shape();
+    private:
+        std::optional<narrow_shape_type> _narrow_shape;
+    };
+
     template <class T>
     class CollisionSize : public virtual IBehavior
     {
@@ -92,8 +137,11 @@ namespace core::basic::behavior
     public:
         const Point& position() const;
         virtual void set_position(const Point& position);
+        // set_position() marks changed as changed too
+        void track_changes(Changed *changed);
     private:
         Point _position;
+        Changed *_changed{nullptr};
     };
 
     class Z_Order: public virtual IBehavior
@@ -108,19 +156,32 @@ namespace core::basic::behavior
     class Changed: public virtual IBehavior
     {
     public:
+        using Queue = helpers::containers::IdQueue<Id>;
         bool changed() const;
         void set_changed(bool changed);
+        // The id is pushed to the queue when the object gets changed, once until unqueue() is called
+        void set_change_queue(Queue *queue, Id id);
+        bool queued() const;
+        void unqueue();
     private:
         bool _changed {false};
+        bool _queued {false};
+        Queue *_queue {nullptr};
+        Id _queue_id {0};
     };
 
     class Dead: public virtual IBehavior
     {
     public:
+        using Queue = helpers::containers::IdQueue<Id>;
         bool dead() const;
         void set_dead();
+        // The id is pushed to the queue once, when the object dies
+        void set_death_queue(Queue *queue, Id id);
     private:
         bool _dead {false};
+        Queue *_queue {nullptr};
+        Id _queue_id {0};
     };
 
     class BoxSize: public virtual IBehavior
@@ -1,6 +1,7 @@
 #ifndef ENGINE_BASICOBJECTS_H
 #define ENGINE_BASICOBJECTS_H
 
+#include <vector>
 #include "core/BasicBehaviors.hpp"
 #include "core/ComplexBehaviors.hpp"
 #include "core/BasicActors.h"
@@ -42,18 +43,30 @@ namespace core::basic::object
             public virtual InitializableObject,
             public virtual basic::behavior::Position,
             public virtual basic::behavior::CollisionShape<AABB>,
+            public virtual basic::behavior::NarrowShape,
             public virtual basic::behavior::CollisionSize<Size>
     {
         friend class helpers::context::BasicContext;
 
     public:
-        using Collisions = std::list<const CollidableObject *>;
+        // NOTE: a vector (formerly a list), so clearing it every frame keeps its capacity
+        using Collisions = std::vector<const CollidableObject *>;
+        // Contacts found by the swept test of fast shapes, time is the part of the move done before the contact
+        struct Impact
+        {
+            const CollidableObject *object;
+            float time;
+        };
+        using Impacts = std::vector<Impact>;
         const Collisions &collisions() const;
+        const Impacts &impacts() const;
         void clear_collisions();
     private:
         Collisions &get_collisions();
+        Impacts &get_impacts();
     private:
         Collisions _collisions;
+        Impacts _impacts;
     };
 
     class RenderableObject :
@@ -1,7 +1,7 @@
 #ifndef ENGINE_CAMERA_H
 #define ENGINE_CAMERA_H
 
-#include <list>
+#include <vector>
 #include <map>
 #include "core/ComplexBehaviors.hpp"
 #include "core/Types.h"
@@ -19,7 +19,7 @@ namespace core
         friend class CameraManager;
     public:
         using ObjectType = const complex::behavior::Renderable*;
-        using List = std::list<ObjectType>;
+        using List = std::vector<ObjectType>;
         void update_visible_objects(List&& list);
         const List& get_visible_objects() const;
         const Size& size() const;
@@ -3,9 +3,19 @@
 
 #include <set>
 #include <map>
+#include <array>
+#include <vector>
+#include <iterator>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <tuple>
 #include <cmath>
 #include <algorithm>
 #include "helpers/Containers.hpp"
+#include "helpers/AABBKernel.h"
+#include "helpers/ThreadPool.h"
 #include "core/BasicBehaviors.hpp"
 #include "Log.h"
 
@@ -23,21 +33,130 @@ namespace core::collision_detector
         using SingleCollisions = std::set<Id>;
         using CollisionPair = std::pair<uint32_t, uint32_t>;
         using PairCollisions = std::set<CollisionPair>;
+        using Ids = std::vector<Id>;
+        using IdBuffer = std::vector<Id>;
+        using PairBuffer = std::vector<CollisionPair>;
+        struct Ray
+        {
+            PointF origin;
+            PointF direction; // unit length
+            float length;
+        };
+        struct RayHit
+        {
+            Id id;
+            float distance; // from the origin to the entry point, 0 if the origin is inside
+        };
+        using RayHits = std::vector<RayHit>;
+        struct Neighbour
+        {
+            Id id;
+            float distance; // from the point to the shape, 0 if the point is inside
+        };
+        using Neighbours = std::vector<Neighbour>;
+        struct Impact
+        {
+            Id fast;
+            Id other;
+            float time; // part of the move done before the contact, in [0, 1]
+        };
+        using Impacts = std::vector<Impact>;
         static constexpr bool check_traits();
         BroadAABBCollisionDetector();
 
         virtual void add(const T &object) = 0;
+        // Bulk load of objects that never move (walls, tiles, etc.)
+        virtual void add_static(const std::vector<const T *> &objects);
         virtual void remove(const T &object) = 0;
         virtual void remove(Id id) = 0;
+        virtual void remove(const Ids &ids);
         virtual void update(const T &object) = 0;
         virtual void update(Id id) = 0;
-        virtual SingleCollisions broad_check(const Point &pt) const = 0;
-        virtual SingleCollisions broad_check(const Rect &rc) const = 0;
-        virtual PairCollisions broad_check() const = 0;
+        virtual void update(const Ids &ids);
+        SingleCollisions broad_check(const Point &pt) const;
+        SingleCollisions broad_check(const Rect &rc) const;
+        PairCollisions broad_check() const;
+        // Results are written sorted and unique into a caller-owned buffer, so a reused buffer does not allocate
+        virtual void broad_check(const Point &pt, IdBuffer &result) const = 0;
+        virtual void broad_check(const Rect &rc, IdBuffer &result) const = 0;
+        virtual void broad_check(PairBuffer &result) const = 0;
+
+        // Hits are sorted by distance; the single-hit versions return the closest one.
+        // Rays with a zero or non-finite direction, a non-finite origin or length, or a negative length hit nothing
+        bool ray_cast(const PointF &origin, const PointF &direction, float length, RayHit &hit) const;
+        void ray_cast(const PointF &origin, const PointF &direction, float length, RayHits &hits) const;
+        bool segment_cast(const PointF &from, const PointF &to, RayHit &hit) const;
+        void segment_cast(const PointF &from, const PointF &to, RayHits &hits) const;
+        virtual bool cast_first(const Ray &ray, RayHit &hit) const = 0;
+        virtual void cast_all(const Ray &ray, RayHits &hits) const = 0;
+
+        // k closest objects sorted by distance; the search square around the point is doubled until they are known
+        void nearest(const Point &pt, uint32_t k, Neighbours &result) const;
+        // Objects whose shape intersects the circle, sorted by id
+        void radius_check(const Point &center, uint32_t radius, IdBuffer &result) const;
+
+        virtual const T *object(Id id) const = 0;
+        virtual size_t size() const = 0;
+
+        // Persistent pairs: only objects added/updated/removed since the last update_pairs() are re-queried.
+        // Objects added before the cache is enabled are all re-queried by the next update_pairs()
+        void set_pair_cache(bool enabled);
+        bool pair_cache() const;
+        void update_pairs();
+        const PairCollisions &pairs() const;
+        const PairCollisions &pairs_began() const;
+        const PairCollisions &pairs_persisting() const;
+        const PairCollisions &pairs_ended() const;
+
+        // Swept test of fast shapes (see FastShape) which moved since the last call, against everything else.
+        // Other fast shapes are swept too, the rest is taken as it is now. Sorted by fast id and time.
+        void sweep(Impacts &impacts);
+
+        // Queries are split across the pool; results do not depend on the amount of workers.
+        void set_thread_pool(helpers::threading::ThreadPool *pool);
+        helpers::threading::ThreadPool *thread_pool() const;
 
         virtual ~BroadAABBCollisionDetector() = default;
 
     protected:
+        // Change notifications from the detectors, keep the pair cache and the sweeps up to date
+        void track_add(const T &object);
+        void track_update(const T &object);
+        void track_remove(Id id);
+        // Every stored object, seeds the pair cache when it is enabled
+        virtual void collect(std::vector<const T *> &objects) const = 0;
+
+        static CollisionPair make_pair(Id a, Id b)
+        { return CollisionPair(std::min(a, b), std::max(a, b)); }
+        template<class Buffer>
+        static void sort_unique(Buffer &buffer);
+        static void merge_pairs(const std::vector<PairBuffer> &buffers, PairBuffer &result);
+        // Pool to split a query across, nullptr when there is none or a single worker would only add overhead
+        helpers::threading::ThreadPool *parallel_pool() const;
+        // Per-worker pair buffers, kept between calls
+        std::vector<PairBuffer> &worker_buffers(size_t workers) const;
+
+        static bool make_ray(const PointF &origin, const PointF &direction, float length, Ray &ray);
+        // Slab test against the part of the ray within [0, length]
+        static bool intersect(const Ray &ray, const AABB &box, float &entry, float &exit);
+        static bool intersect(const Ray &ray, const AABB &box, float &distance)
+        {
+            float exit;
+            return intersect(ray, box, distance, exit);
+        }
+        static bool closer(const RayHit &a, const RayHit &b)
+        { return a.distance < b.distance || (a.distance == b.distance && a.id < b.id); }
+        // Sorts hits by distance and keeps the first hit of every id
+        static void sort_hits(RayHits &hits);
+
+        static uint64_t distance2(const Point &pt, const AABB &shape);
+        static bool contains(const AABB &outer, const AABB &inner)
+        {
+            return outer.top_left.x <= inner.top_left.x && outer.top_left.y <= inner.top_left.y &&
+                   inner.bottom_right.x <= outer.bottom_right.x && inner.bottom_right.y <= outer.bottom_right.y;
+        }
+        static Rect square(const Point &center, uint64_t radius);
+
         static const AABB &get_shape(const T &object)
         {
             if constexpr (std::is_same_v<behavior_type, CollisionShape<AABB>>)
@@ -50,7 +169,61 @@ namespace core::collision_detector
             // NOTE: this code should never be called in normal circumstances
             assert(false);
         }
+
+        // Cached copy of CollisionFilter; objects without one collide with everything
+        struct Filter
+        {
+            uint32_t layer{std::numeric_limits<uint32_t>::max()};
+            uint32_t mask{std::numeric_limits<uint32_t>::max()};
+            bool accepts(const Filter &other) const
+            { return (layer & other.mask) != 0 && (other.layer & mask) != 0; }
+            bool operator!=(const Filter &other) const
+            { return layer != other.layer || mask != other.mask; }
+        };
+        static Filter get_filter(const T &object)
+        {
+            if constexpr (std::is_base_of_v<CollisionFilter, T>)
+            {
+                return {object.collision_layer(), object.collision_mask()};
+            }
+            return {};
+        }
+        static bool accepts(const T &object, const T &other)
+        { return get_filter(object).accepts(get_filter(other)); }
     private:
+        // NOTE: partner lists are sorted vectors, swapped with the query buffers to keep their capacity
+        struct PairCache
+        {
+            bool enabled{false};
+            std::map<Id, const T *> objects;
+            std::map<Id, IdBuffer> partners;
+            IdBuffer dirty;
+            IdBuffer removed;
+            std::vector<IdBuffer> found;
+            PairCollisions pairs;
+            PairCollisions began;
+            PairCollisions persisting;
+            PairCollisions ended;
+        };
+        PairCache _cache;
+
+        static constexpr bool has_fast_shape = std::is_base_of_v<FastShape, T>;
+        static bool is_fast(const T &object);
+        static bool time_of_impact(const AABB &from, const AABB &to, const AABB &other_from, const AABB &other_to,
+                                   float &time);
+        struct Sweep
+        {
+            AABB from;
+            AABB to;
+            bool moved{false};
+        };
+        static AABB sweep_area(const Sweep &sweep);
+        std::unordered_map<Id, Sweep> _sweeps;
+        IdBuffer _moved;
+        IdBuffer _swept;
+
+        helpers::threading::ThreadPool *_thread_pool{nullptr};
+        mutable std::vector<PairBuffer> _worker_buffers;
     };
 
     template<class T, template<class> class Behavior>
@@ -68,278 +241,2958 @@ namespace core::collision_detector
         return has_collision_shape && has_unique_id;
     }
 
-
-    template<class T, template<class> class Behavior = CollisionShape>
-    class HierarchicalSpatialGrid : public BroadAABBCollisionDetector<T, Behavior>
+    template<class T, template<class> class Behavior>
+    void BroadAABBCollisionDetector<T, Behavior>::add_static(const std::vector<const T *> &objects)
     {
-    public:
-        using Id = typename T::unique_id_type;
-        using value_type = typename BroadAABBCollisionDetector<T, Behavior>::value_type;
-        using behavior_type = typename BroadAABBCollisionDetector<T, Behavior>::behavior_type;
-        using Size = helpers::containers::Size2D<uint32_t>;
-        using SingleCollisions = typename BroadAABBCollisionDetector<T, Behavior>::SingleCollisions;
-        using CollisionPair = typename BroadAABBCollisionDetector<T, Behavior>::CollisionPair;
-        using PairCollisions = typename BroadAABBCollisionDetector<T, Behavior>::PairCollisions;
-
-        HierarchicalSpatialGrid() = default;
-
-        void add(const T &object) override;
-        void remove(const T &object) override;
-        void remove(Id id) override;
-        SingleCollisions broad_check(const Point &pt) const override;
-        void update(const T &object) override;
-        void update(Id id) override;
-        SingleCollisions broad_check(const Rect &roi) const override;
-        PairCollisions broad_check() const override;
-
-        void set_world_size(const Size &size);
-
-    private:
-        using Map = std::set<Id>;
-        using Grid = helpers::containers::Matrix<Map, 2>;
-        using GridMap = std::map<uint32_t, Grid>;
-
-        static uint32_t calc_level(const AABB &shape);
-        static uint32_t calc_cell_size(uint32_t level);
-        Rect calc_roi(uint32_t level, const AABB &shape) const;
-        static Point calc_cell(uint32_t level, const Point &pt);
+        for (auto object: objects)
+        {
+            add(*object);
+        }
+    }
 
-        struct ObjectInfo
+    template<class T, template<class> class Behavior>
+    void BroadAABBCollisionDetector<T, Behavior>::remove(const Ids &ids)
+    {
+        for (auto id: ids)
         {
-            const T *object{nullptr};
-            uint32_t level{0};
-            Rect roi{0, 0, 0, 0};
-        };
+            remove(id);
+        }
+    }
 
-        Size _world_size{0, 0};
-        GridMap _grid_map;
-        std::map<Id, ObjectInfo> _objects;
-        std::map<uint32_t, uint32_t> _objects_per_level;
-    };
+    template<class T, template<class> class Behavior>
+    void BroadAABBCollisionDetector<T, Behavior>::update(const Ids &ids)
+    {
+        for (auto id: ids)
+        {
+            update(id);
+        }
+    }
 
+    template<class T, template<class> class Behavior>
+    void BroadAABBCollisionDetector<T, Behavior>::set_pair_cache(bool enabled)
+    {
+        _cache = PairCache();
+        _cache.enabled = enabled;
+        if (!enabled)
+        {
+            return;
+        }
+        std::vector<const T *> objects;
+        collect(objects);
+        for (auto object: objects)
+        {
+            auto id = object->unique_id();
+            _cache.objects[id] = object;
+            _cache.dirty.push_back(id);
+        }
+    }
 
     template<class T, template<class> class Behavior>
-    void HierarchicalSpatialGrid<T, Behavior>::set_world_size(const Size &size)
+    bool BroadAABBCollisionDetector<T, Behavior>::pair_cache() const
     {
-        _world_size = size;
+        return _cache.enabled;
     }
 
     template<class T, template<class> class Behavior>
-    uint32_t HierarchicalSpatialGrid<T, Behavior>::calc_level(const AABB &shape)
+    typename BroadAABBCollisionDetector<T, Behavior>::SingleCollisions
+    BroadAABBCollisionDetector<T, Behavior>::broad_check(const Point &pt) const
     {
-        auto max_side = std::max(shape.width(), shape.height());
-        return (uint32_t) (std::log2(max_side));
+        IdBuffer result;
+        broad_check(pt, result);
+        return SingleCollisions(result.begin(), result.end());
     }
 
     template<class T, template<class> class Behavior>
-    uint32_t HierarchicalSpatialGrid<T, Behavior>::calc_cell_size(uint32_t level)
+    typename BroadAABBCollisionDetector<T, Behavior>::SingleCollisions
+    BroadAABBCollisionDetector<T, Behavior>::broad_check(const Rect &rc) const
     {
-        return (uint32_t) (std::exp2(level + 1));
+        IdBuffer result;
+        broad_check(rc, result);
+        return SingleCollisions(result.begin(), result.end());
     }
 
     template<class T, template<class> class Behavior>
-    Rect HierarchicalSpatialGrid<T, Behavior>::calc_roi(uint32_t level, const AABB &shape) const
+    typename BroadAABBCollisionDetector<T, Behavior>::PairCollisions
+    BroadAABBCollisionDetector<T, Behavior>::broad_check() const
     {
-        auto cell_size = calc_cell_size(level);
-        AABB fixed_shape =
-                {
-                        std::clamp(shape.top_left.y, (uint32_t)0, _world_size.y),
-                        std::clamp(shape.top_left.x, (uint32_t)0, _world_size.x),
-                        std::clamp(shape.bottom_right.y, (uint32_t)0, _world_size.y),
-                        std::clamp(shape.bottom_right.x, (uint32_t)0, _world_size.x),
-                };
-        Point left_top(fixed_shape.top_left.x / cell_size, fixed_shape.top_left.y / cell_size);
-        Point right_bottom(fixed_shape.bottom_right.x / cell_size, fixed_shape.bottom_right.y / cell_size);
-        return Rect(left_top, right_bottom);
+        PairBuffer result;
+        broad_check(result);
+        return PairCollisions(result.begin(), result.end());
     }
 
     template<class T, template<class> class Behavior>
-    Point HierarchicalSpatialGrid<T, Behavior>::calc_cell(uint32_t level, const Point &pt)
+    bool BroadAABBCollisionDetector<T, Behavior>::ray_cast(const PointF &origin, const PointF &direction, float length,
+                                                           RayHit &hit) const
     {
-        auto cell_size = calc_cell_size(level);
-        return Point(pt.x / cell_size, pt.y / cell_size);
+        Ray ray;
+        return make_ray(origin, direction, length, ray) && cast_first(ray, hit);
     }
 
     template<class T, template<class> class Behavior>
-    void HierarchicalSpatialGrid<T, Behavior>::add(const T &object)
+    void BroadAABBCollisionDetector<T, Behavior>::ray_cast(const PointF &origin, const PointF &direction, float length,
+                                                           RayHits &hits) const
     {
-        auto id = object.unique_id();
-        if (_objects.count(id) > 0)
+        hits.clear();
+        Ray ray;
+        if (make_ray(origin, direction, length, ray))
         {
-            return;
+            cast_all(ray, hits);
         }
+    }
 
-        auto level = calc_level(this->get_shape(object));
-        auto roi = calc_roi(level, this->get_shape(object));
+    template<class T, template<class> class Behavior>
+    bool BroadAABBCollisionDetector<T, Behavior>::segment_cast(const PointF &from, const PointF &to, RayHit &hit) const
+    {
+        PointF direction(to.x - from.x, to.y - from.y);
+        return ray_cast(from, direction, std::hypot(direction.x, direction.y), hit);
+    }
 
-        _objects[id] = ObjectInfo();
-        _objects[id].object = &object;
-        _objects[id].level = level;
-        _objects[id].roi = roi;
+    template<class T, template<class> class Behavior>
+    void BroadAABBCollisionDetector<T, Behavior>::segment_cast(const PointF &from, const PointF &to, RayHits &hits) const
+    {
+        PointF direction(to.x - from.x, to.y - from.y);
+        ray_cast(from, direction, std::hypot(direction.x, direction.y), hits);
+    }
 
-        if (_grid_map.count(level) == 0)
+    template<class T, template<class> class Behavior>
+    bool BroadAABBCollisionDetector<T, Behavior>::make_ray(const PointF &origin, const PointF &direction, float length,
+                                                           Ray &ray)
+    {
+        // NOTE: NaN passes the comparisons below, non-finite values would break the cell walks
+        if (!std::isfinite(origin.x) || !std::isfinite(origin.y) || !std::isfinite(length))
         {
-            auto cell_size = calc_cell_size(level);
-            _grid_map[level] = Grid();
-            _grid_map[level].create({_world_size.y / cell_size + 1, _world_size.x / cell_size + 1});
-            _objects_per_level[level] = 0;
+            return false;
         }
-        LOG_D("Add: %d to l: %d", id, level)
-        for (uint32_t y = roi.top_left.y; y <= roi.bottom_right.y; ++y)
+        auto norm = std::hypot(direction.x, direction.y);
+        if (!std::isfinite(norm) || norm <= 0.f || length < 0.f)
         {
-            for (uint32_t x = roi.top_left.x; x <= roi.bottom_right.x; ++x)
+            return false;
+        }
+        ray.origin = origin;
+        ray.direction = PointF(direction.x / norm, direction.y / norm);
+        ray.length = length;
+        return true;
+    }
+
+    template<class T, template<class> class Behavior>
+    bool BroadAABBCollisionDetector<T, Behavior>::intersect(const Ray &ray, const AABB &box, float &entry, float &exit)
+    {
+        float t_min = 0.f;
+        float t_max = ray.length;
+        const float origin[2] = {ray.origin.x, ray.origin.y};
+        const float direction[2] = {ray.direction.x, ray.direction.y};
+        const float low[2] = {(float) box.top_left.x, (float) box.top_left.y};
+        const float high[2] = {(float) box.bottom_right.x, (float) box.bottom_right.y};
+        for (int axis = 0; axis < 2; ++axis)
+        {
+            if (direction[axis] == 0.f)
             {
-                LOG_D("      x: %d y: %d", x, y)
-                _grid_map[level][y][x].insert(id);
+                if (origin[axis] < low[axis] || origin[axis] > high[axis])
+                {
+                    return false;
+                }
+                continue;
+            }
+            float t1 = (low[axis] - origin[axis]) / direction[axis];
+            float t2 = (high[axis] - origin[axis]) / direction[axis];
+            if (t1 > t2)
+            {
+                std::swap(t1, t2);
+            }
+            t_min = std::max(t_min, t1);
+            t_max = std::min(t_max, t2);
+            if (t_min > t_max)
+            {
+                return false;
             }
         }
-        _objects_per_level[level]++;
+        entry = t_min;
+        exit = t_max;
+        return true;
     }
 
     template<class T, template<class> class Behavior>
-    void HierarchicalSpatialGrid<T, Behavior>::remove(const T &object)
+    void BroadAABBCollisionDetector<T, Behavior>::sort_hits(RayHits &hits)
     {
-        auto id = object.unique_id();
-        remove(id);
+        std::sort(hits.begin(), hits.end(), [](const RayHit &a, const RayHit &b)
+        {
+            return a.id < b.id || (a.id == b.id && a.distance < b.distance);
+        });
+        hits.erase(std::unique(hits.begin(), hits.end(), [](const RayHit &a, const RayHit &b)
+        {
+            return a.id == b.id;
+        }), hits.end());
+        std::sort(hits.begin(), hits.end(), closer);
     }
 
     template<class T, template<class> class Behavior>
-    void HierarchicalSpatialGrid<T, Behavior>::remove(Id id)
+    void BroadAABBCollisionDetector<T, Behavior>::nearest(const Point &pt, uint32_t k, Neighbours &result) const
     {
-        if (_objects.count(id) == 0)
+        result.clear();
+        if (k == 0)
         {
             return;
         }
-//        LOG_D("Remove: %d", id)
-        auto object_info = _objects[id];
-        auto level = object_info.level;
-        auto roi = object_info.roi;
-        for (uint32_t y = roi.top_left.y; y <= roi.bottom_right.y; ++y)
+        // NOTE: result is a max-heap (by distance) of the best k candidates until the end
+        auto closer = [](const Neighbour &a, const Neighbour &b)
         {
-            for (uint32_t x = roi.top_left.x; x <= roi.bottom_right.x; ++x)
+            return a.distance < b.distance || (a.distance == b.distance && a.id < b.id);
+        };
+        thread_local IdBuffer found;
+        auto total = size();
+        size_t seen = 0;
+        uint64_t radius = 16;
+        Rect inner;
+        bool first = true;
+        while (true)
+        {
+            auto outer = square(pt, radius);
+            broad_check(outer, found);
+            for (auto id: found)
+            {
+                auto item = object(id);
+                if (item == nullptr)
+                {
+                    continue;
+                }
+                const auto &shape = get_shape(*item);
+                // objects touching the previous square were handled on the previous ring
+                if (!first && (inner && shape))
+                {
+                    continue;
+                }
+                ++seen;
+                Neighbour neighbour{id, std::sqrt((float) distance2(pt, shape))};
+                if (result.size() < k)
+                {
+                    result.push_back(neighbour);
+                    std::push_heap(result.begin(), result.end(), closer);
+                }
+                else if (closer(neighbour, result.front()))
+                {
+                    std::pop_heap(result.begin(), result.end(), closer);
+                    result.back() = neighbour;
+                    std::push_heap(result.begin(), result.end(), closer);
+                }
+            }
+            if (seen >= total || (result.size() == k && result.front().distance <= (float) radius) ||
+                radius > std::numeric_limits<uint32_t>::max())
             {
-                _grid_map[level][y][x].erase(id);
+                break;
             }
+            inner = outer;
+            first = false;
+            radius *= 2;
         }
-        _objects_per_level[level]--;
-        if (_objects_per_level[level] == 0)
+        std::sort_heap(result.begin(), result.end(), closer);
+    }
+
+    template<class T, template<class> class Behavior>
+    void BroadAABBCollisionDetector<T, Behavior>::radius_check(const Point &center, uint32_t radius,
+                                                               IdBuffer &result) const
+    {
+        broad_check(square(center, radius), result);
+        auto limit = (uint64_t) radius * radius;
+        result.erase(std::remove_if(result.begin(), result.end(), [&](Id id)
         {
-            _grid_map.erase(level);
+            auto item = object(id);
+            return item == nullptr || distance2(center, get_shape(*item)) > limit;
+        }), result.end());
+    }
+
+    template<class T, template<class> class Behavior>
+    uint64_t BroadAABBCollisionDetector<T, Behavior>::distance2(const Point &pt, const AABB &shape)
+    {
+        auto axis = [](uint32_t value, uint32_t low, uint32_t high) -> uint64_t
+        {
+            if (value < low)
+            {
+                return low - value;
+            }
+            return value > high ? value - high : 0;
+        };
+        auto dx = axis(pt.x, shape.top_left.x, shape.bottom_right.x);
+        auto dy = axis(pt.y, shape.top_left.y, shape.bottom_right.y);
+        return dx * dx + dy * dy;
+    }
+
+    template<class T, template<class> class Behavior>
+    Rect BroadAABBCollisionDetector<T, Behavior>::square(const Point &center, uint64_t radius)
+    {
+        const uint64_t max = std::numeric_limits<uint32_t>::max();
+        return {
+                (uint32_t) (center.y > radius ? center.y - radius : 0),
+                (uint32_t) (center.x > radius ? center.x - radius : 0),
+                (uint32_t) std::min(center.y + radius, max),
+                (uint32_t) std::min(center.x + radius, max)
+        };
+    }
+
+    template<class T, template<class> class Behavior>
+    template<class Buffer>
+    void BroadAABBCollisionDetector<T, Behavior>::sort_unique(Buffer &buffer)
+    {
+        std::sort(buffer.begin(), buffer.end());
+        buffer.erase(std::unique(buffer.begin(), buffer.end()), buffer.end());
+    }
+
+    template<class T, template<class> class Behavior>
+    void BroadAABBCollisionDetector<T, Behavior>::merge_pairs(const std::vector<PairBuffer> &buffers, PairBuffer &result)
+    {
+        result.clear();
+        for (const auto &buffer: buffers)
+        {
+            result.insert(result.end(), buffer.begin(), buffer.end());
         }
-        _objects.erase(id);
+        sort_unique(result);
     }
 
     template<class T, template<class> class Behavior>
-    void HierarchicalSpatialGrid<T, Behavior>::update(const T &object)
+    std::vector<typename BroadAABBCollisionDetector<T, Behavior>::PairBuffer> &
+    BroadAABBCollisionDetector<T, Behavior>::worker_buffers(size_t workers) const
     {
-        auto id = object.unique_id();
-        update(id);
+        _worker_buffers.resize(workers);
+        for (auto &buffer: _worker_buffers)
+        {
+            buffer.clear();
+        }
+        return _worker_buffers;
+    }
+
+    template<class T, template<class> class Behavior>
+    void BroadAABBCollisionDetector<T, Behavior>::set_thread_pool(helpers::threading::ThreadPool *pool)
+    {
+        _thread_pool = pool;
+    }
+
+    template<class T, template<class> class Behavior>
+    helpers::threading::ThreadPool *BroadAABBCollisionDetector<T, Behavior>::thread_pool() const
+    {
+        return _thread_pool;
+    }
+
+    template<class T, template<class> class Behavior>
+    helpers::threading::ThreadPool *BroadAABBCollisionDetector<T, Behavior>::parallel_pool() const
+    {
+        return _thread_pool != nullptr && _thread_pool->size() >= 2 ? _thread_pool : nullptr;
     }
 
     template<class T, template<class> class Behavior>
-    void HierarchicalSpatialGrid<T, Behavior>::update(Id id)
+    void BroadAABBCollisionDetector<T, Behavior>::track_add(const T &object)
     {
-        if (_objects.count(id) == 0)
+        if (is_fast(object))
         {
-            return;
+            _sweeps[object.unique_id()] = {get_shape(object), get_shape(object), false};
         }
-        const auto &object = *(_objects[id].object);
-        auto level = calc_level(this->get_shape(object));
-        auto roi = calc_roi(level, this->get_shape(object));
-        if (level != _objects[id].level || roi != _objects[id].roi)
+        if (!_cache.enabled)
         {
-            remove(id);
-            add(object);
+            return;
         }
+        auto id = object.unique_id();
+        _cache.objects[id] = &object;
+        _cache.dirty.push_back(id);
     }
+
     template<class T, template<class> class Behavior>
-    typename HierarchicalSpatialGrid<T, Behavior>::SingleCollisions
-    HierarchicalSpatialGrid<T, Behavior>::broad_check(const Point &pt) const
+    void BroadAABBCollisionDetector<T, Behavior>::track_update(const T &object)
     {
-        SingleCollisions collisions;
-        Point fixed_pt = {
-                std::clamp(pt.x, (uint32_t) 0, _world_size.x),
-                std::clamp(pt.y, (uint32_t) 0, _world_size.y)
-        };
-        for (const auto &l: _grid_map)
+        if (has_fast_shape)
         {
-            const auto&[level, grid] = l;
-            auto cell = calc_cell(level, fixed_pt);
-            for (const auto &o: grid[cell.y][cell.x])
+            auto sweep = _sweeps.find(object.unique_id());
+            if (sweep != _sweeps.end() && !is_fast(object))
+            {
+                _sweeps.erase(sweep);
+            }
+            else if (sweep == _sweeps.end() && is_fast(object))
             {
-                auto object = _objects.find(o);
-                if (object != _objects.end())
+                _sweeps[object.unique_id()] = {get_shape(object), get_shape(object), false};
+            }
+            else if (sweep != _sweeps.end() && sweep->second.to != get_shape(object))
+            {
+                // several updates between sweeps make one move
+                if (!sweep->second.moved)
                 {
-                    auto shape = this->get_shape(*(object->second.object));
-                    if (pt.x < shape.bottom_right.x && pt.x > shape.top_left.x
-                        &&
-                        pt.y < shape.bottom_right.y && pt.y > shape.top_left.y)
-                    {
-                        collisions.insert(o);
-                    }
+                    sweep->second.from = sweep->second.to;
+                    sweep->second.moved = true;
                 }
+                sweep->second.to = get_shape(object);
             }
         }
-        return collisions;
+        if (!_cache.enabled)
+        {
+            return;
+        }
+        _cache.dirty.push_back(object.unique_id());
     }
 
     template<class T, template<class> class Behavior>
-    typename HierarchicalSpatialGrid<T, Behavior>::SingleCollisions
-    HierarchicalSpatialGrid<T, Behavior>::broad_check(const Roi &roi) const
+    void BroadAABBCollisionDetector<T, Behavior>::track_remove(Id id)
     {
-        SingleCollisions collisions;
-        Rect fixed_rc = {
-                std::clamp(roi.top_left.y, (uint32_t) 0, _world_size.y),
-                std::clamp(roi.top_left.x, (uint32_t) 0, _world_size.x),
-                std::clamp(roi.bottom_right.y, (uint32_t) 0, _world_size.y),
-                std::clamp(roi.bottom_right.x, (uint32_t) 0, _world_size.x)
-        };
-        for (const auto &l: _grid_map)
+        _sweeps.erase(id);
+        if (!_cache.enabled)
         {
-            const auto&[level, grid] = l;
-            auto roi = calc_roi(level, fixed_rc);
-            for (uint32_t y = roi.top_left.y; y <= roi.bottom_right.y; ++y)
-            {
-                for (uint32_t x = roi.top_left.x; x <= roi.bottom_right.x; ++x)
-                {
-                    for (const auto &o: grid[y][x])
-                    {
-                        auto object = _objects.find(o);
-                        if (object != _objects.end())
-                        {
-                            if (fixed_rc && this->get_shape(*(object->second.object)))
-                            {
-                                collisions.insert(o);
-                            }
-                        }
-                    }
-                }
-            }
+            return;
         }
-        return collisions;
+        _cache.objects.erase(id);
+        _cache.removed.push_back(id);
     }
 
     template<class T, template<class> class Behavior>
-    typename HierarchicalSpatialGrid<T, Behavior>::PairCollisions HierarchicalSpatialGrid<T, Behavior>::broad_check() const
+    bool BroadAABBCollisionDetector<T, Behavior>::is_fast(const T &object)
     {
-        PairCollisions collisions;
-        for (const auto &item: _objects)
+        if constexpr (has_fast_shape)
         {
-            const auto&[id, object_info] = item;
-            if (object_info.object->is_static_shape())
-            {
-                continue;
-            }
-            auto single_collisions = broad_check(this->get_shape(*object_info.object));
-            single_collisions.erase(id);
-            for (const auto &collision: single_collisions)
+            return object.is_fast_shape();
+        }
+        return false;
+    }
+
+    template<class T, template<class> class Behavior>
+    void BroadAABBCollisionDetector<T, Behavior>::sweep(Impacts &impacts)
+    {
+        impacts.clear();
+        _moved.clear();
+        for (const auto &item: _sweeps)
+        {
+            if (item.second.moved)
             {
-                auto first = std::min(id, collision);
-                auto second = std::max(id, collision);
-                collisions.insert(CollisionPair(first, second));
+                _moved.push_back(item.first);
             }
         }
-        return collisions;
+        std::sort(_moved.begin(), _moved.end());
+        auto is_moved = [this](Id id)
+        {
+            return std::binary_search(_moved.begin(), _moved.end(), id);
+        };
+        for (size_t i = 0; i < _moved.size(); ++i)
+        {
+            auto id = _moved[i];
+            const auto &sweep = _sweeps[id];
+            const auto &fast = *object(id);
+            bool is_static = fast.is_static_shape();
+            float time;
+            // everything which did not move is taken where it is now
+            broad_check(sweep_area(sweep), _swept);
+            for (auto other: _swept)
+            {
+                if (other == id || is_moved(other) || (is_static && object(other)->is_static_shape()) ||
+                    !accepts(fast, *object(other)))
+                {
+                    continue;
+                }
+                const auto &shape = get_shape(*object(other));
+                if (time_of_impact(sweep.from, sweep.to, shape, shape, time))
+                {
+                    impacts.push_back({id, other, time});
+                }
+            }
+            // NOTE: fast shapes which moved are met along both moves; there are usually few of them
+            for (size_t j = i + 1; j < _moved.size(); ++j)
+            {
+                auto other = _moved[j];
+                const auto &other_sweep = _sweeps[other];
+                if (!(sweep_area(sweep) && sweep_area(other_sweep)) ||
+                    (is_static && object(other)->is_static_shape()) || !accepts(fast, *object(other)))
+                {
+                    continue;
+                }
+                if (time_of_impact(sweep.from, sweep.to, other_sweep.from, other_sweep.to, time))
+                {
+                    impacts.push_back({id, other, time});
+                }
+            }
+        }
+        for (auto id: _moved)
+        {
+            _sweeps[id].moved = false;
+        }
+        std::sort(impacts.begin(), impacts.end(), [](const Impact &a, const Impact &b)
+        {
+            return std::tie(a.fast, a.time, a.other) < std::tie(b.fast, b.time, b.other);
+        });
+    }
+
+    template<class T, template<class> class Behavior>
+    AABB BroadAABBCollisionDetector<T, Behavior>::sweep_area(const Sweep &sweep)
+    {
+        AABB area = sweep.from;
+        area.top_left.x = std::min(area.top_left.x, sweep.to.top_left.x);
+        area.top_left.y = std::min(area.top_left.y, sweep.to.top_left.y);
+        area.bottom_right.x = std::max(area.bottom_right.x, sweep.to.bottom_right.x);
+        area.bottom_right.y = std::max(area.bottom_right.y, sweep.to.bottom_right.y);
+        return area;
+    }
+
+    // Moves of both boxes are taken as translations of their top left corners. In the frame of the other box
+    // the box moves along a segment, which is tested against the other box grown by the size of the box.
+    template<class T, template<class> class Behavior>
+    bool BroadAABBCollisionDetector<T, Behavior>::time_of_impact(const AABB &from, const AABB &to,
+                                                                 const AABB &other_from, const AABB &other_to,
+                                                                 float &time)
+    {
+        const float move[2] = {
+                ((float) to.top_left.x - from.top_left.x) - ((float) other_to.top_left.x - other_from.top_left.x),
+                ((float) to.top_left.y - from.top_left.y) - ((float) other_to.top_left.y - other_from.top_left.y)
+        };
+        const float origin[2] = {(float) from.top_left.x, (float) from.top_left.y};
+        const float low[2] = {
+                (float) other_from.top_left.x - ((float) from.bottom_right.x - from.top_left.x),
+                (float) other_from.top_left.y - ((float) from.bottom_right.y - from.top_left.y)
+        };
+        const float high[2] = {(float) other_from.bottom_right.x, (float) other_from.bottom_right.y};
+        float t_min = 0.f;
+        float t_max = 1.f;
+        for (int axis = 0; axis < 2; ++axis)
+        {
+            if (move[axis] == 0.f)
+            {
+                if (origin[axis] < low[axis] || origin[axis] > high[axis])
+                {
+                    return false;
+                }
+                continue;
+            }
+            float t1 = (low[axis] - origin[axis]) / move[axis];
+            float t2 = (high[axis] - origin[axis]) / move[axis];
+            if (t1 > t2)
+            {
+                std::swap(t1, t2);
+            }
+            t_min = std::max(t_min, t1);
+            t_max = std::min(t_max, t2);
+            if (t_min > t_max)
+            {
+                return false;
+            }
+        }
+        time = t_min;
+        return true;
+    }
+
+    template<class T, template<class> class Behavior>
+    void BroadAABBCollisionDetector<T, Behavior>::update_pairs()
+    {
+        auto &cache = _cache;
+        if (!cache.enabled)
+        {
+            cache.began.clear();
+            cache.ended.clear();
+            cache.pairs = broad_check();
+            cache.persisting = cache.pairs;
+            return;
+        }
+        // pairs which began last time persist unless they end now
+        cache.persisting.insert(cache.began.begin(), cache.began.end());
+        cache.began.clear();
+        cache.ended.clear();
+        auto unlink = [&cache](Id id, Id partner)
+        {
+            auto &list = cache.partners[partner];
+            auto it = std::lower_bound(list.begin(), list.end(), id);
+            if (it != list.end() && *it == id)
+            {
+                list.erase(it);
+            }
+        };
+        for (auto id: cache.removed)
+        {
+            auto partners = cache.partners.find(id);
+            if (partners == cache.partners.end())
+            {
+                continue;
+            }
+            for (auto partner: partners->second)
+            {
+                auto pair = make_pair(id, partner);
+                cache.pairs.erase(pair);
+                cache.persisting.erase(pair);
+                cache.ended.insert(pair);
+                unlink(id, partner);
+            }
+            cache.partners.erase(partners);
+        }
+        cache.removed.clear();
+
+        auto &dirty = cache.dirty;
+        sort_unique(dirty);
+        dirty.erase(std::remove_if(dirty.begin(), dirty.end(), [&cache](Id id)
+        {
+            return cache.objects.count(id) == 0;
+        }), dirty.end());
+        if (cache.found.size() < dirty.size())
+        {
+            cache.found.resize(dirty.size());
+        }
+        auto find_partners = [&](size_t begin, size_t end, uint32_t)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const T &object = *cache.objects.find(dirty[i])->second;
+                auto &found = cache.found[i];
+                broad_check(get_shape(object), found);
+                bool is_static = object.is_static_shape();
+                auto filter = get_filter(object);
+                found.erase(std::remove_if(found.begin(), found.end(), [&](Id other)
+                {
+                    if (other == dirty[i])
+                    {
+                        return true;
+                    }
+                    auto item = this->object(other);
+                    return item == nullptr || (is_static && item->is_static_shape()) ||
+                           !filter.accepts(get_filter(*item));
+                }), found.end());
+            }
+        };
+        if (auto pool = parallel_pool())
+        {
+            pool->parallel_for(dirty.size(), find_partners);
+        }
+        else
+        {
+            find_partners(0, dirty.size(), 0);
+        }
+
+        for (size_t i = 0; i < dirty.size(); ++i)
+        {
+            auto id = dirty[i];
+            auto &found = cache.found[i];
+            auto &current = cache.partners[id];
+            for (auto partner: current)
+            {
+                if (!std::binary_search(found.begin(), found.end(), partner))
+                {
+                    auto pair = make_pair(id, partner);
+                    cache.pairs.erase(pair);
+                    cache.persisting.erase(pair);
+                    cache.ended.insert(pair);
+                    unlink(id, partner);
+                }
+            }
+            for (auto partner: found)
+            {
+                if (!std::binary_search(current.begin(), current.end(), partner))
+                {
+                    auto pair = make_pair(id, partner);
+                    cache.pairs.insert(pair);
+                    cache.began.insert(pair);
+                    auto &list = cache.partners[partner];
+                    list.insert(std::lower_bound(list.begin(), list.end(), id), id);
+                }
+            }
+            current.swap(found);
+        }
+        dirty.clear();
+    }
+
+    template<class T, template<class> class Behavior>
+    const typename BroadAABBCollisionDetector<T, Behavior>::PairCollisions &
+    BroadAABBCollisionDetector<T, Behavior>::pairs() const
+    {
+        return _cache.pairs;
+    }
+
+    template<class T, template<class> class Behavior>
+    const typename BroadAABBCollisionDetector<T, Behavior>::PairCollisions &
+    BroadAABBCollisionDetector<T, Behavior>::pairs_began() const
+    {
+        return _cache.began;
+    }
+
+    template<class T, template<class> class Behavior>
+    const typename BroadAABBCollisionDetector<T, Behavior>::PairCollisions &
+    BroadAABBCollisionDetector<T, Behavior>::pairs_persisting() const
+    {
+        return _cache.persisting;
+    }
+
+    template<class T, template<class> class Behavior>
+    const typename BroadAABBCollisionDetector<T, Behavior>::PairCollisions &
+    BroadAABBCollisionDetector<T, Behavior>::pairs_ended() const
+    {
+        return _cache.ended;
+    }
+
+
+    // Cell storages for HierarchicalSpatialGrid.
+    // OrderedCell keeps every cell as a tree, FlatCell keeps the slots in a contiguous array
+    // (no node allocation per insert, capacity is reused between frames).
+    template<class Id>
+    using OrderedCell = std::set<Id>;
+
+    template<class Id>
+    class FlatCell
+    {
+    public:
+        using value_type = Id;
+        using const_iterator = typename std::vector<Id>::const_iterator;
+        // NOTE: no duplicates check, grid never inserts the same slot into the cell twice
+        void insert(const Id &id)
+        { _ids.push_back(id); }
+        void erase(const Id &id)
+        {
+            auto it = std::find(_ids.begin(), _ids.end(), id);
+            if (it != _ids.end())
+            {
+                *it = _ids.back();
+                _ids.pop_back();
+            }
+        }
+        bool empty() const
+        { return _ids.empty(); }
+        size_t size() const
+        { return _ids.size(); }
+        const_iterator begin() const
+        { return _ids.cbegin(); }
+        const_iterator end() const
+        { return _ids.cend(); }
+    private:
+        std::vector<Id> _ids;
+    };
+
+    // Grid layouts for HierarchicalSpatialGrid.
+    // DenseGrid allocates every cell of a level up front, SparseGrid keeps only occupied cells in a hash map,
+    // so its memory follows the amount of occupied cells instead of the world area.
+    template<class Cell>
+    class DenseGrid
+    {
+    public:
+        void create(uint32_t rows, uint32_t cols)
+        {
+            _cells.create({rows, cols});
+            _count = (size_t) rows * cols;
+        }
+        Cell &at(uint32_t y, uint32_t x)
+        { return _cells[y][x]; }
+        const Cell *find(uint32_t y, uint32_t x) const
+        { return &_cells[y][x]; }
+        void release(uint32_t /*y*/, uint32_t /*x*/)
+        {}
+        // every cell of the level, occupied or not
+        size_t cell_count() const
+        { return _count; }
+        // visits every cell of the rect (inclusive, in cells)
+        template<class Visitor>
+        void for_each(const Rect &cells, Visitor &&visitor) const
+        {
+            for (uint32_t y = cells.top_left.y; y <= cells.bottom_right.y; ++y)
+            {
+                for (uint32_t x = cells.top_left.x; x <= cells.bottom_right.x; ++x)
+                {
+                    visitor(_cells[y][x]);
+                }
+            }
+        }
+    private:
+        helpers::containers::Matrix<Cell, 2> _cells;
+        size_t _count{0};
+    };
+
+    template<class Cell>
+    class SparseGrid
+    {
+    public:
+        void create(uint32_t /*rows*/, uint32_t /*cols*/)
+        { _cells.clear(); }
+        Cell &at(uint32_t y, uint32_t x)
+        { return _cells[key(y, x)]; }
+        const Cell *find(uint32_t y, uint32_t x) const
+        {
+            auto cell = _cells.find(key(y, x));
+            return cell != _cells.end() ? &cell->second : nullptr;
+        }
+        void release(uint32_t y, uint32_t x)
+        {
+            auto cell = _cells.find(key(y, x));
+            if (cell != _cells.end() && cell->second.empty())
+            {
+                _cells.erase(cell);
+            }
+        }
+        // occupied cells only
+        size_t cell_count() const
+        { return _cells.size(); }
+        // visits only occupied cells of the rect (inclusive, in cells)
+        template<class Visitor>
+        void for_each(const Rect &cells, Visitor &&visitor) const
+        {
+            uint64_t area = ((uint64_t) cells.width() + 1) * ((uint64_t) cells.height() + 1);
+            if (area > _cells.size())
+            {
+                for (const auto &[cell_key, cell]: _cells)
+                {
+                    uint32_t y = (uint32_t) (cell_key >> 32);
+                    uint32_t x = (uint32_t) cell_key;
+                    if (x >= cells.top_left.x && x <= cells.bottom_right.x &&
+                        y >= cells.top_left.y && y <= cells.bottom_right.y)
+                    {
+                        visitor(cell);
+                    }
+                }
+                return;
+            }
+            for (uint32_t y = cells.top_left.y; y <= cells.bottom_right.y; ++y)
+            {
+                for (uint32_t x = cells.top_left.x; x <= cells.bottom_right.x; ++x)
+                {
+                    auto cell = find(y, x);
+                    if (cell != nullptr)
+                    {
+                        visitor(*cell);
+                    }
+                }
+            }
+        }
+    private:
+        static uint64_t key(uint32_t y, uint32_t x)
+        { return ((uint64_t) y << 32) | x; }
+        std::unordered_map<uint64_t, Cell> _cells;
+    };
+
+    template<class T, template<class> class Behavior = CollisionShape, template<class> class Cell = OrderedCell,
+            template<class> class Layout = DenseGrid>
+    class HierarchicalSpatialGrid : public BroadAABBCollisionDetector<T, Behavior>
+    {
+    public:
+        using Id = typename T::unique_id_type;
+        using value_type = typename BroadAABBCollisionDetector<T, Behavior>::value_type;
+        using behavior_type = typename BroadAABBCollisionDetector<T, Behavior>::behavior_type;
+        using Size = helpers::containers::Size2D<uint32_t>;
+        using SingleCollisions = typename BroadAABBCollisionDetector<T, Behavior>::SingleCollisions;
+        using CollisionPair = typename BroadAABBCollisionDetector<T, Behavior>::CollisionPair;
+        using PairCollisions = typename BroadAABBCollisionDetector<T, Behavior>::PairCollisions;
+        using Ids = typename BroadAABBCollisionDetector<T, Behavior>::Ids;
+        using IdBuffer = typename BroadAABBCollisionDetector<T, Behavior>::IdBuffer;
+        using PairBuffer = typename BroadAABBCollisionDetector<T, Behavior>::PairBuffer;
+        using Ray = typename BroadAABBCollisionDetector<T, Behavior>::Ray;
+        using RayHit = typename BroadAABBCollisionDetector<T, Behavior>::RayHit;
+        using RayHits = typename BroadAABBCollisionDetector<T, Behavior>::RayHits;
+
+        HierarchicalSpatialGrid();
+
+        void add(const T &object) override;
+        // Static shapes go to a separate immutable layer which is only rebuilt on removal
+        void add_static(const std::vector<const T *> &objects) override;
+        void remove(const T &object) override;
+        void remove(Id id) override;
+        // The static layer is rebuilt at most once per batch
+        void remove(const Ids &ids) override;
+        void update(const T &object) override;
+        void update(Id id) override;
+        void update(const Ids &ids) override;
+        using BroadAABBCollisionDetector<T, Behavior>::broad_check;
+        void broad_check(const Point &pt, IdBuffer &result) const override;
+        void broad_check(const Rect &roi, IdBuffer &result) const override;
+        void broad_check(PairBuffer &result) const override;
+        bool cast_first(const Ray &ray, RayHit &hit) const override;
+        void cast_all(const Ray &ray, RayHits &hits) const override;
+        const T *object(Id id) const override;
+        size_t size() const override;
+
+        void set_world_size(const Size &size);
+        // Objects are linked to cells with a margin of (looseness - 1) / 2 cells around them,
+        // so they are re-bucketed only after leaving the margin. NOTE: applies to objects placed afterwards
+        void set_looseness(float looseness);
+        // Size levels holding few objects are merged into coarser ones, so queries visit fewer grids.
+        // The levels are re-tuned after every batch update.
+        void set_auto_tune(bool auto_tune);
+        // Object records are kept in one array; with a period they are sorted by the Morton code of their
+        // centers every period batch updates, so records of close objects are close in memory. 0 turns it off.
+        void set_morton_order(uint32_t period);
+
+        struct Stats
+        {
+            uint64_t updates{0};
+            uint64_t rebuckets{0};
+            uint64_t retunes{0};
+        };
+        // NOTE: counters grow until reset, e.g. reset them every frame to get per-frame numbers
+        const Stats &stats() const;
+        void reset_stats();
+        // Cells the layout holds for the dynamic objects (all cells of the used levels for DenseGrid,
+        // occupied ones for SparseGrid) and cells the used levels span over the whole world
+        size_t cell_count() const;
+        size_t world_cells() const;
+
+    protected:
+        void collect(std::vector<const T *> &objects) const override;
+
+    private:
+        // NOTE: cells hold slots of _objects, so candidates are read without a lookup by id
+        using Map = Cell<uint32_t>;
+        using Grid = Layout<Map>;
+        using GridMap = std::map<uint32_t, Grid>;
+        using Filter = typename BroadAABBCollisionDetector<T, Behavior>::Filter;
+
+        static constexpr uint32_t size_levels = 32;
+        static uint32_t calc_size_level(const AABB &shape);
+        uint32_t calc_level(const AABB &shape) const;
+        static uint32_t calc_cell_size(uint32_t level);
+        AABB loosen(uint32_t level, const AABB &shape) const;
+        Rect calc_roi(uint32_t level, const AABB &shape) const;
+        static Point calc_cell(uint32_t level, const Point &pt);
+        Rect fix_roi(const Rect &roi) const;
+        void insert(const T &object);
+        void erase(Id id);
+        void link(uint32_t slot, uint32_t level, const Rect &roi);
+        void unlink(uint32_t slot, uint32_t level, const Rect &roi);
+        bool update_static(Id id);
+        bool remove_static(Id id);
+        size_t apply_moves();
+        void tune_levels();
+        void sort_objects();
+        static uint64_t morton_code(const AABB &shape);
+        void build_static();
+        template<class Visitor>
+        void for_each_static(const AABB &shape, Visitor visitor) const;
+
+        struct Scratch
+        {
+            helpers::containers::AABBBatch batch;
+            helpers::containers::AABBBatch::Tags hits;
+        };
+        static Scratch &scratch();
+        // Unsorted hits (with duplicates) of a clamped region, valid until the next query on this thread
+        // Candidates rejected by the filter are skipped before the overlap test
+        const helpers::containers::AABBBatch::Tags &query(const Rect &fixed_rc, const Filter *filter = nullptr) const;
+        template<class Visitor>
+        void traverse(uint32_t level, const Ray &ray, float entry, float exit, Visitor visitor) const;
+        template<class Visitor, class Limit>
+        void walk(const Ray &ray, Visitor visitor, Limit limit) const;
+
+        struct ObjectInfo
+        {
+            const T *object{nullptr};
+            Id id{0};
+            AABB shape{0, 0, 0, 0};
+            // shape with the loose margin, the object is linked to the cells of it
+            AABB bounds{0, 0, 0, 0};
+            Filter filter;
+            uint32_t size_level{0};
+            uint32_t level{0};
+            Rect roi{0, 0, 0, 0};
+        };
+
+        const ObjectInfo *find(Id id) const;
+        ObjectInfo *find(Id id);
+
+        Size _world_size{0, 0};
+        GridMap _grid_map;
+        std::vector<ObjectInfo> _objects;
+        std::unordered_map<Id, uint32_t> _slots;
+        uint32_t _morton_period{0};
+        uint32_t _batches{0};
+        std::vector<std::pair<uint64_t, uint32_t>> _order;
+        std::vector<ObjectInfo> _sorted;
+        std::map<uint32_t, uint32_t> _objects_per_level;
+        float _looseness{1.f};
+        bool _auto_tune{false};
+        // grid level of every size level, and the amount of dynamic objects per size level
+        std::array<uint32_t, size_levels> _level_map{};
+        std::array<uint32_t, size_levels> _objects_per_size_level{};
+        Stats _stats;
+
+        // NOTE: slots stay valid during a batch update, objects are only appended
+        struct Move
+        {
+            Id id;
+            uint32_t slot;
+            uint32_t level;
+            AABB bounds;
+            Rect roi;
+        };
+        std::vector<Move> _moves;
+        mutable std::vector<const ObjectInfo *> _sources;
+
+        struct StaticInfo
+        {
+            const T *object{nullptr};
+            Id id{0};
+            AABB shape{0, 0, 0, 0};
+            Filter filter;
+            uint32_t level{0};
+            Rect roi{0, 0, 0, 0};
+        };
+        // Cells of a level in CSR form: cells[i] holds items[offsets[i]] .. items[offsets[i + 1] - 1]
+        struct StaticLevel
+        {
+            std::vector<uint64_t> cells;
+            std::vector<uint32_t> offsets;
+            std::vector<uint32_t> items;
+        };
+        std::vector<StaticInfo> _statics;
+        std::unordered_map<Id, uint32_t> _static_slots;
+        std::map<uint32_t, StaticLevel> _static_levels;
+        uint32_t _statics_removed{0};
+    };
+
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::HierarchicalSpatialGrid()
+    {
+        for (uint32_t i = 0; i < size_levels; ++i)
+        {
+            _level_map[i] = i;
+        }
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::set_world_size(const Size &size)
+    {
+        _world_size = size;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::set_looseness(float looseness)
+    {
+        _looseness = std::max(looseness, 1.f);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::set_auto_tune(bool auto_tune)
+    {
+        _auto_tune = auto_tune;
+        tune_levels();
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::set_morton_order(uint32_t period)
+    {
+        _morton_period = period;
+        _batches = 0;
+        if (period > 0)
+        {
+            sort_objects();
+        }
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    const typename HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::Stats &
+    HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::stats() const
+    {
+        return _stats;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::reset_stats()
+    {
+        _stats = Stats();
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    size_t HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::cell_count() const
+    {
+        size_t count = 0;
+        for (const auto &[level, grid]: _grid_map)
+        {
+            count += grid.cell_count();
+        }
+        return count;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    size_t HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::world_cells() const
+    {
+        size_t count = 0;
+        for (const auto &[level, grid]: _grid_map)
+        {
+            auto cell_size = calc_cell_size(level);
+            count += (size_t) (_world_size.y / cell_size + 1) * (_world_size.x / cell_size + 1);
+        }
+        return count;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    uint32_t HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::calc_size_level(const AABB &shape)
+    {
+        auto max_side = std::max(shape.width(), shape.height());
+        return max_side < 2 ? 0 : (uint32_t) (std::log2(max_side));
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    uint32_t HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::calc_level(const AABB &shape) const
+    {
+        return _level_map[calc_size_level(shape)];
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    AABB HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::loosen(uint32_t level, const AABB &shape) const
+    {
+        if (_looseness <= 1.f)
+        {
+            return shape;
+        }
+        auto margin = (uint64_t) (calc_cell_size(level) * (_looseness - 1.f) / 2.f);
+        return {
+                (uint32_t) (shape.top_left.y - std::min<uint64_t>(shape.top_left.y, margin)),
+                (uint32_t) (shape.top_left.x - std::min<uint64_t>(shape.top_left.x, margin)),
+                (uint32_t) std::min<uint64_t>((uint64_t) shape.bottom_right.y + margin, _world_size.y),
+                (uint32_t) std::min<uint64_t>((uint64_t) shape.bottom_right.x + margin, _world_size.x)
+        };
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    uint32_t HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::calc_cell_size(uint32_t level)
+    {
+        return (uint32_t) (std::exp2(level + 1));
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    Rect HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::calc_roi(uint32_t level, const AABB &shape) const
+    {
+        auto cell_size = calc_cell_size(level);
+        AABB fixed_shape =
+                {
+                        std::clamp(shape.top_left.y, (uint32_t)0, _world_size.y),
+                        std::clamp(shape.top_left.x, (uint32_t)0, _world_size.x),
+                        std::clamp(shape.bottom_right.y, (uint32_t)0, _world_size.y),
+                        std::clamp(shape.bottom_right.x, (uint32_t)0, _world_size.x),
+                };
+        Point left_top(fixed_shape.top_left.x / cell_size, fixed_shape.top_left.y / cell_size);
+        Point right_bottom(fixed_shape.bottom_right.x / cell_size, fixed_shape.bottom_right.y / cell_size);
+        return Rect(left_top, right_bottom);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    Point HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::calc_cell(uint32_t level, const Point &pt)
+    {
+        auto cell_size = calc_cell_size(level);
+        return Point(pt.x / cell_size, pt.y / cell_size);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::add(const T &object)
+    {
+        if (_slots.count(object.unique_id()) > 0 || _static_slots.count(object.unique_id()) > 0)
+        {
+            return;
+        }
+        insert(object);
+        this->track_add(object);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::add_static(const std::vector<const T *> &objects)
+    {
+        // NOTE: a rebuild is not worth it for a handful of objects
+        bool rebuild = objects.size() * 8 >= _static_slots.size();
+        for (auto object: objects)
+        {
+            auto id = object->unique_id();
+            if (!rebuild || !object->is_static_shape())
+            {
+                add(*object);
+                continue;
+            }
+            if (_slots.count(id) > 0 || _static_slots.count(id) > 0)
+            {
+                continue;
+            }
+            StaticInfo info;
+            info.object = object;
+            info.id = id;
+            info.shape = this->get_shape(*object);
+            info.filter = this->get_filter(*object);
+            info.level = calc_level(info.shape);
+            info.roi = calc_roi(info.level, info.shape);
+            _static_slots[id] = _statics.size();
+            _statics.push_back(info);
+            this->track_add(*object);
+        }
+        if (rebuild)
+        {
+            build_static();
+        }
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::build_static()
+    {
+        if (_statics_removed > 0)
+        {
+            _statics.erase(std::remove_if(_statics.begin(), _statics.end(), [](const StaticInfo &info)
+            {
+                return info.object == nullptr;
+            }), _statics.end());
+            for (uint32_t i = 0; i < _statics.size(); ++i)
+            {
+                _static_slots[_statics[i].id] = i;
+            }
+            _statics_removed = 0;
+        }
+        std::map<uint32_t, std::vector<std::pair<uint64_t, uint32_t>>> keys;
+        for (uint32_t i = 0; i < _statics.size(); ++i)
+        {
+            const auto &roi = _statics[i].roi;
+            auto &level_keys = keys[_statics[i].level];
+            for (uint32_t y = roi.top_left.y; y <= roi.bottom_right.y; ++y)
+            {
+                for (uint32_t x = roi.top_left.x; x <= roi.bottom_right.x; ++x)
+                {
+                    level_keys.emplace_back(((uint64_t) y << 32) | x, i);
+                }
+            }
+        }
+        _static_levels.clear();
+        for (auto &[level, level_keys]: keys)
+        {
+            std::sort(level_keys.begin(), level_keys.end());
+            auto &static_level = _static_levels[level];
+            static_level.items.reserve(level_keys.size());
+            for (const auto &[key, item]: level_keys)
+            {
+                if (static_level.cells.empty() || static_level.cells.back() != key)
+                {
+                    static_level.cells.push_back(key);
+                    static_level.offsets.push_back(static_level.items.size());
+                }
+                static_level.items.push_back(item);
+            }
+            static_level.offsets.push_back(static_level.items.size());
+        }
+    }
+
+    // Visits every live static object whose cells overlap the shape's cells (an object may be visited several times)
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    template<class Visitor>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::for_each_static(const AABB &shape, Visitor visitor) const
+    {
+        for (const auto &[level, static_level]: _static_levels)
+        {
+            const auto &cells = static_level.cells;
+            auto roi = calc_roi(level, shape);
+            for (uint32_t y = roi.top_left.y; y <= roi.bottom_right.y; ++y)
+            {
+                uint64_t last = ((uint64_t) y << 32) | roi.bottom_right.x;
+                auto it = std::lower_bound(cells.begin(), cells.end(), ((uint64_t) y << 32) | roi.top_left.x);
+                for (; it != cells.end() && *it <= last; ++it)
+                {
+                    auto cell = it - cells.begin();
+                    for (auto i = static_level.offsets[cell]; i < static_level.offsets[cell + 1]; ++i)
+                    {
+                        const auto &info = _statics[static_level.items[i]];
+                        if (info.object != nullptr)
+                        {
+                            visitor(info);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Returns true if the id belongs to the static layer. Objects which moved or stopped being static
+    // are moved to the dynamic grid.
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    bool HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::update_static(Id id)
+    {
+        auto slot = _static_slots.find(id);
+        if (slot == _static_slots.end())
+        {
+            return false;
+        }
+        auto &info = _statics[slot->second];
+        const auto &object = *info.object;
+        if (object.is_static_shape() && info.shape == this->get_shape(object))
+        {
+            auto filter = this->get_filter(object);
+            if (filter != info.filter)
+            {
+                info.filter = filter;
+                this->track_update(object);
+            }
+            return true;
+        }
+        info.object = nullptr;
+        _statics_removed++;
+        _static_slots.erase(slot);
+        insert(object);
+        this->track_update(object);
+        if (_statics_removed * 2 > _statics.size())
+        {
+            build_static();
+        }
+        return true;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::insert(const T &object)
+    {
+        auto id = object.unique_id();
+        const auto &shape = this->get_shape(object);
+        auto level = calc_level(shape);
+        auto bounds = loosen(level, shape);
+        auto roi = calc_roi(level, bounds);
+
+        ObjectInfo info;
+        info.object = &object;
+        info.id = id;
+        info.shape = shape;
+        info.bounds = bounds;
+        info.filter = this->get_filter(object);
+        info.size_level = calc_size_level(shape);
+        info.level = level;
+        info.roi = roi;
+        auto slot = (uint32_t) _objects.size();
+        _slots[id] = slot;
+        _objects.push_back(info);
+
+        LOG_D("Add: %d to l: %d", id, level)
+        link(slot, level, roi);
+        _objects_per_level[level]++;
+        _objects_per_size_level[info.size_level]++;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::link(uint32_t slot, uint32_t level, const Rect &roi)
+    {
+        if (_grid_map.count(level) == 0)
+        {
+            auto cell_size = calc_cell_size(level);
+            _grid_map[level] = Grid();
+            _grid_map[level].create(_world_size.y / cell_size + 1, _world_size.x / cell_size + 1);
+            _objects_per_level[level] = 0;
+        }
+        auto &grid = _grid_map[level];
+        for (uint32_t y = roi.top_left.y; y <= roi.bottom_right.y; ++y)
+        {
+            for (uint32_t x = roi.top_left.x; x <= roi.bottom_right.x; ++x)
+            {
+                LOG_D("      x: %d y: %d", x, y)
+                grid.at(y, x).insert(slot);
+            }
+        }
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::unlink(uint32_t slot, uint32_t level, const Rect &roi)
+    {
+        auto &grid = _grid_map[level];
+        for (uint32_t y = roi.top_left.y; y <= roi.bottom_right.y; ++y)
+        {
+            for (uint32_t x = roi.top_left.x; x <= roi.bottom_right.x; ++x)
+            {
+                grid.at(y, x).erase(slot);
+                grid.release(y, x);
+            }
+        }
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::remove(const T &object)
+    {
+        auto id = object.unique_id();
+        remove(id);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::remove(Id id)
+    {
+        if (remove_static(id))
+        {
+            if (_statics_removed * 2 > _statics.size())
+            {
+                build_static();
+            }
+            return;
+        }
+        if (_slots.count(id) == 0)
+        {
+            return;
+        }
+        erase(id);
+        this->track_remove(id);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::remove(const Ids &ids)
+    {
+        bool statics_removed = false;
+        for (auto id: ids)
+        {
+            if (remove_static(id))
+            {
+                statics_removed = true;
+                continue;
+            }
+            if (_slots.count(id) == 0)
+            {
+                continue;
+            }
+            erase(id);
+            this->track_remove(id);
+        }
+        if (statics_removed && _statics_removed * 2 > _statics.size())
+        {
+            build_static();
+        }
+    }
+
+    // Leaves a hole in the static layer, build_static() drops the holes
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    bool HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::remove_static(Id id)
+    {
+        auto slot = _static_slots.find(id);
+        if (slot == _static_slots.end())
+        {
+            return false;
+        }
+        _statics[slot->second].object = nullptr;
+        _static_slots.erase(slot);
+        _statics_removed++;
+        this->track_remove(id);
+        return true;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::erase(Id id)
+    {
+//        LOG_D("Remove: %d", id)
+        auto slot = _slots[id];
+        auto object_info = _objects[slot];
+        auto level = object_info.level;
+        unlink(slot, level, object_info.roi);
+        _objects_per_level[level]--;
+        _objects_per_size_level[object_info.size_level]--;
+        if (_objects_per_level[level] == 0)
+        {
+            _grid_map.erase(level);
+        }
+        // the last record takes the freed slot, its cells are relinked to it
+        auto last = (uint32_t) _objects.size() - 1;
+        if (slot != last)
+        {
+            const auto &moved = _objects[last];
+            unlink(last, moved.level, moved.roi);
+            link(slot, moved.level, moved.roi);
+            _objects[slot] = moved;
+            _slots[moved.id] = slot;
+        }
+        _objects.pop_back();
+        _slots.erase(id);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::update(const T &object)
+    {
+        auto id = object.unique_id();
+        update(id);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::update(Id id)
+    {
+        auto item = find(id);
+        if (item == nullptr)
+        {
+            update_static(id);
+            return;
+        }
+        auto &info = *item;
+        const auto &object = *info.object;
+        const auto &shape = this->get_shape(object);
+        auto level = calc_level(shape);
+        auto bounds = loosen(level, shape);
+        auto roi = calc_roi(level, bounds);
+        _stats.updates++;
+        if (level != info.level || (roi != info.roi && !this->contains(info.bounds, shape)))
+        {
+            _stats.rebuckets++;
+            erase(id);
+            insert(object);
+        }
+        else
+        {
+            if (roi == info.roi)
+            {
+                info.bounds = bounds;
+            }
+            info.shape = shape;
+            info.filter = this->get_filter(object);
+            _objects_per_size_level[info.size_level]--;
+            info.size_level = calc_size_level(shape);
+            _objects_per_size_level[info.size_level]++;
+        }
+        this->track_update(object);
+    }
+
+    // Computes new cells for all objects first, then unlinks and links the moved ones in cell order.
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::update(const Ids &ids)
+    {
+        _moves.clear();
+        for (auto id: ids)
+        {
+            auto slot = _slots.find(id);
+            if (slot == _slots.end())
+            {
+                update_static(id);
+                continue;
+            }
+            auto &info = _objects[slot->second];
+            const auto &shape = this->get_shape(*info.object);
+            auto level = calc_level(shape);
+            auto bounds = loosen(level, shape);
+            auto roi = calc_roi(level, bounds);
+            info.shape = shape;
+            info.filter = this->get_filter(*info.object);
+            _objects_per_size_level[info.size_level]--;
+            info.size_level = calc_size_level(shape);
+            _objects_per_size_level[info.size_level]++;
+            _stats.updates++;
+            if (level != info.level || (roi != info.roi && !this->contains(info.bounds, shape)))
+            {
+                _moves.push_back({id, slot->second, level, bounds, roi});
+            }
+            else if (roi == info.roi)
+            {
+                info.bounds = bounds;
+            }
+            this->track_update(*info.object);
+        }
+        _stats.rebuckets += apply_moves();
+        if (_auto_tune)
+        {
+            tune_levels();
+        }
+        if (_morton_period > 0 && ++_batches >= _morton_period)
+        {
+            sort_objects();
+        }
+    }
+
+    // Relinks objects from _moves to their new cells in cell order, returns the amount of moved objects
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    size_t HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::apply_moves()
+    {
+        if (_moves.empty())
+        {
+            return 0;
+        }
+        auto cell_order = [](uint32_t level_a, const Rect &a, uint32_t level_b, const Rect &b)
+        {
+            return std::tie(level_a, a.top_left.y, a.top_left.x) < std::tie(level_b, b.top_left.y, b.top_left.x);
+        };
+        std::sort(_moves.begin(), _moves.end(), [&](const Move &a, const Move &b)
+        {
+            const auto &info_a = _objects[a.slot];
+            const auto &info_b = _objects[b.slot];
+            return cell_order(info_a.level, info_a.roi, info_b.level, info_b.roi) ||
+                   (!cell_order(info_b.level, info_b.roi, info_a.level, info_a.roi) && a.id < b.id);
+        });
+        // NOTE: the same id may be passed several times
+        _moves.erase(std::unique(_moves.begin(), _moves.end(), [](const Move &a, const Move &b)
+        {
+            return a.id == b.id;
+        }), _moves.end());
+        for (const auto &move: _moves)
+        {
+            const auto &info = _objects[move.slot];
+            unlink(move.slot, info.level, info.roi);
+            _objects_per_level[info.level]--;
+        }
+        std::sort(_moves.begin(), _moves.end(), [&](const Move &a, const Move &b)
+        {
+            return cell_order(a.level, a.roi, b.level, b.roi);
+        });
+        for (const auto &move: _moves)
+        {
+            auto &info = _objects[move.slot];
+            link(move.slot, move.level, move.roi);
+            _objects_per_level[move.level]++;
+            info.level = move.level;
+            info.bounds = move.bounds;
+            info.roi = move.roi;
+        }
+        for (auto it = _objects_per_level.begin(); it != _objects_per_level.end();)
+        {
+            if (it->second == 0)
+            {
+                _grid_map.erase(it->first);
+                it = _objects_per_level.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return _moves.size();
+    }
+
+    // A size level gets its own grid if it holds enough objects, otherwise it joins the next one (at most two
+    // levels up). The thresholds differ for levels which have their own grid already, so small changes do not flip it.
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::tune_levels()
+    {
+        constexpr uint32_t max_merged = 2;
+        std::array<uint32_t, size_levels> level_map{};
+        uint32_t total = 0;
+        uint32_t top = 0;
+        for (uint32_t i = 0; i < size_levels; ++i)
+        {
+            level_map[i] = i;
+            total += _objects_per_size_level[i];
+            top = _objects_per_size_level[i] > 0 ? i : top;
+        }
+        if (_auto_tune)
+        {
+            uint32_t first = 0;
+            for (uint32_t i = 0; i < top; ++i)
+            {
+                auto min_count = _level_map[i] == i ? total / 64 : total / 32;
+                if (_objects_per_size_level[i] > min_count || i - first == max_merged)
+                {
+                    std::fill(level_map.begin() + first, level_map.begin() + i + 1, i);
+                    first = i + 1;
+                }
+            }
+            std::fill(level_map.begin() + first, level_map.begin() + top + 1, top);
+        }
+        if (level_map == _level_map)
+        {
+            return;
+        }
+        _level_map = level_map;
+        _stats.retunes++;
+        _moves.clear();
+        for (uint32_t slot = 0; slot < _objects.size(); ++slot)
+        {
+            const auto &info = _objects[slot];
+            auto level = calc_level(info.shape);
+            if (level != info.level)
+            {
+                auto bounds = loosen(level, info.shape);
+                _moves.push_back({info.id, slot, level, bounds, calc_roi(level, bounds)});
+            }
+        }
+        apply_moves();
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::sort_objects()
+    {
+        _batches = 0;
+        _order.clear();
+        for (uint32_t slot = 0; slot < _objects.size(); ++slot)
+        {
+            _order.emplace_back(morton_code(_objects[slot].shape), slot);
+        }
+        std::sort(_order.begin(), _order.end());
+        // NOTE: cells hold slots, so every object is relinked; cells get filled in the new order
+        for (uint32_t slot = 0; slot < _objects.size(); ++slot)
+        {
+            unlink(slot, _objects[slot].level, _objects[slot].roi);
+        }
+        _sorted.clear();
+        for (const auto &item: _order)
+        {
+            _slots[_objects[item.second].id] = _sorted.size();
+            _sorted.push_back(_objects[item.second]);
+        }
+        _objects.swap(_sorted);
+        for (uint32_t slot = 0; slot < _objects.size(); ++slot)
+        {
+            link(slot, _objects[slot].level, _objects[slot].roi);
+        }
+    }
+
+    // Bits of the center's x and y interleaved, so the order follows a Z curve
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    uint64_t HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::morton_code(const AABB &shape)
+    {
+        auto spread = [](uint64_t value)
+        {
+            value = (value | (value << 16)) & 0x0000FFFF0000FFFFull;
+            value = (value | (value << 8)) & 0x00FF00FF00FF00FFull;
+            value = (value | (value << 4)) & 0x0F0F0F0F0F0F0F0Full;
+            value = (value | (value << 2)) & 0x3333333333333333ull;
+            value = (value | (value << 1)) & 0x5555555555555555ull;
+            return value;
+        };
+        auto x = ((uint64_t) shape.top_left.x + shape.bottom_right.x) / 2;
+        auto y = ((uint64_t) shape.top_left.y + shape.bottom_right.y) / 2;
+        return spread(x) | (spread(y) << 1);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::broad_check(const Point &pt, IdBuffer &result) const
+    {
+        Point fixed_pt = {
+                std::clamp(pt.x, (uint32_t) 0, _world_size.x),
+                std::clamp(pt.y, (uint32_t) 0, _world_size.y)
+        };
+        auto &[batch, hits] = scratch();
+        for (const auto &l: _grid_map)
+        {
+            const auto&[level, grid] = l;
+            auto pos = calc_cell(level, fixed_pt);
+            auto cell = grid.find(pos.y, pos.x);
+            if (cell == nullptr)
+            {
+                continue;
+            }
+            for (auto slot: *cell)
+            {
+                const auto &object = _objects[slot];
+                batch.push_back(object.shape, object.id);
+            }
+        }
+        for_each_static(AABB(fixed_pt.y, fixed_pt.x, fixed_pt.y, fixed_pt.x), [&](const StaticInfo &info)
+        {
+            batch.push_back(info.shape, info.id);
+        });
+        batch.contain(pt, hits);
+        result.assign(hits.begin(), hits.end());
+        this->sort_unique(result);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::broad_check(const Roi &roi, IdBuffer &result) const
+    {
+        const auto &hits = query(fix_roi(roi));
+        result.assign(hits.begin(), hits.end());
+        this->sort_unique(result);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    Rect HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::fix_roi(const Rect &roi) const
+    {
+        return {
+                std::clamp(roi.top_left.y, (uint32_t) 0, _world_size.y),
+                std::clamp(roi.top_left.x, (uint32_t) 0, _world_size.x),
+                std::clamp(roi.bottom_right.y, (uint32_t) 0, _world_size.y),
+                std::clamp(roi.bottom_right.x, (uint32_t) 0, _world_size.x)
+        };
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    const helpers::containers::AABBBatch::Tags &
+    HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::query(const Rect &fixed_rc, const Filter *filter) const
+    {
+        // candidates are gathered first and tested in one go
+        auto &[batch, hits] = scratch();
+        for (const auto &l: _grid_map)
+        {
+            const auto&[level, grid] = l;
+            auto roi = calc_roi(level, fixed_rc);
+            grid.for_each(roi, [&](const Map &cell)
+            {
+                for (auto slot: cell)
+                {
+                    const auto &object = _objects[slot];
+                    if (filter == nullptr || filter->accepts(object.filter))
+                    {
+                        batch.push_back(object.shape, object.id);
+                    }
+                }
+            });
+        }
+        for_each_static(fixed_rc, [&](const StaticInfo &info)
+        {
+            if (filter == nullptr || filter->accepts(info.filter))
+            {
+                batch.push_back(info.shape, info.id);
+            }
+        });
+        batch.intersect(fixed_rc, hits);
+        return hits;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    typename HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::Scratch &
+    HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::scratch()
+    {
+        // NOTE: queries may run on several pool workers at once
+        thread_local Scratch scratch;
+        scratch.batch.clear();
+        scratch.hits.clear();
+        return scratch;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::broad_check(PairBuffer &result) const
+    {
+        auto find_pairs = [this](const ObjectInfo &source, PairBuffer &buffer)
+        {
+            auto id = source.id;
+            for (auto other: query(fix_roi(source.shape), &source.filter))
+            {
+                if (other != id)
+                {
+                    buffer.push_back(this->make_pair(id, other));
+                }
+            }
+        };
+        result.clear();
+        auto pool = this->parallel_pool();
+        if (pool == nullptr)
+        {
+            for (const auto &info: _objects)
+            {
+                if (!info.object->is_static_shape())
+                {
+                    find_pairs(info, result);
+                }
+            }
+            this->sort_unique(result);
+            return;
+        }
+
+        // every worker fills its own buffer, buffers are merged and sorted afterwards
+        _sources.clear();
+        for (const auto &info: _objects)
+        {
+            if (!info.object->is_static_shape())
+            {
+                _sources.push_back(&info);
+            }
+        }
+        auto &buffers = this->worker_buffers(pool->size());
+        pool->parallel_for(_sources.size(), [&](size_t begin, size_t end, uint32_t worker)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                find_pairs(*_sources[i], buffers[worker]);
+            }
+        });
+        this->merge_pairs(buffers, result);
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    const typename HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::ObjectInfo *
+    HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::find(Id id) const
+    {
+        auto slot = _slots.find(id);
+        return slot != _slots.end() ? &_objects[slot->second] : nullptr;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    typename HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::ObjectInfo *
+    HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::find(Id id)
+    {
+        auto slot = _slots.find(id);
+        return slot != _slots.end() ? &_objects[slot->second] : nullptr;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    const T *HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::object(Id id) const
+    {
+        auto item = find(id);
+        if (item != nullptr)
+        {
+            return item->object;
+        }
+        auto slot = _static_slots.find(id);
+        return slot != _static_slots.end() ? _statics[slot->second].object : nullptr;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    size_t HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::size() const
+    {
+        return _objects.size() + _static_slots.size();
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::collect(std::vector<const T *> &objects) const
+    {
+        for (const auto &info: _objects)
+        {
+            objects.push_back(info.object);
+        }
+        for (const auto &[id, slot]: _static_slots)
+        {
+            objects.push_back(_statics[slot].object);
+        }
+    }
+
+    // Amanatides-Woo walk over the cells of a level crossed by the ray between entry and exit.
+    // visitor(y, x, t) gets the distance the cell is entered at and returns false to stop.
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    template<class Visitor>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::traverse(uint32_t level, const Ray &ray, float entry,
+                                                                       float exit, Visitor visitor) const
+    {
+        const auto cell_size = (float) calc_cell_size(level);
+        const int64_t last_x = _world_size.x / calc_cell_size(level);
+        const int64_t last_y = _world_size.y / calc_cell_size(level);
+        const float inf = std::numeric_limits<float>::infinity();
+        float px = ray.origin.x + ray.direction.x * entry;
+        float py = ray.origin.y + ray.direction.y * entry;
+        auto x = std::clamp((int64_t) std::floor(px / cell_size), (int64_t) 0, last_x);
+        auto y = std::clamp((int64_t) std::floor(py / cell_size), (int64_t) 0, last_y);
+        int64_t step_x = ray.direction.x > 0.f ? 1 : (ray.direction.x < 0.f ? -1 : 0);
+        int64_t step_y = ray.direction.y > 0.f ? 1 : (ray.direction.y < 0.f ? -1 : 0);
+        float next_x = step_x == 0 ? inf : entry + ((x + (step_x > 0)) * cell_size - px) / ray.direction.x;
+        float next_y = step_y == 0 ? inf : entry + ((y + (step_y > 0)) * cell_size - py) / ray.direction.y;
+        float delta_x = step_x == 0 ? inf : cell_size / std::abs(ray.direction.x);
+        float delta_y = step_y == 0 ? inf : cell_size / std::abs(ray.direction.y);
+        float t = entry;
+        while (visitor((uint32_t) y, (uint32_t) x, t))
+        {
+            if (next_x < next_y)
+            {
+                t = next_x;
+                x += step_x;
+                next_x += delta_x;
+            }
+            else
+            {
+                t = next_y;
+                y += step_y;
+                next_y += delta_y;
+            }
+            if (t > exit || x < 0 || y < 0 || x > last_x || y > last_y)
+            {
+                break;
+            }
+        }
+    }
+
+    // Calls visitor(id, shape) for objects in the cells crossed by the ray; cells entered beyond limit() are skipped
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    template<class Visitor, class Limit>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::walk(const Ray &ray, Visitor visitor, Limit limit) const
+    {
+        float entry, exit;
+        if (!this->intersect(ray, AABB(0, 0, _world_size.y, _world_size.x), entry, exit))
+        {
+            return;
+        }
+        for (const auto &[level, grid]: _grid_map)
+        {
+            traverse(level, ray, entry, exit, [&](uint32_t y, uint32_t x, float t)
+            {
+                if (t > limit())
+                {
+                    return false;
+                }
+                auto cell = grid.find(y, x);
+                if (cell != nullptr)
+                {
+                    for (auto slot: *cell)
+                    {
+                        const auto &object = _objects[slot];
+                        visitor(object.id, object.shape);
+                    }
+                }
+                return true;
+            });
+        }
+        for (const auto &[level, static_level]: _static_levels)
+        {
+            const auto &cells = static_level.cells;
+            traverse(level, ray, entry, exit, [&](uint32_t y, uint32_t x, float t)
+            {
+                if (t > limit())
+                {
+                    return false;
+                }
+                auto key = ((uint64_t) y << 32) | x;
+                auto it = std::lower_bound(cells.begin(), cells.end(), key);
+                if (it != cells.end() && *it == key)
+                {
+                    auto cell = it - cells.begin();
+                    for (auto i = static_level.offsets[cell]; i < static_level.offsets[cell + 1]; ++i)
+                    {
+                        const auto &info = _statics[static_level.items[i]];
+                        if (info.object != nullptr)
+                        {
+                            visitor(info.id, info.shape);
+                        }
+                    }
+                }
+                return true;
+            });
+        }
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    bool HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::cast_first(const Ray &ray, RayHit &hit) const
+    {
+        bool found = false;
+        walk(ray, [&](Id id, const AABB &shape)
+        {
+            RayHit candidate{id, 0.f};
+            if (this->intersect(ray, shape, candidate.distance) && (!found || this->closer(candidate, hit)))
+            {
+                hit = candidate;
+                found = true;
+            }
+        }, [&]()
+        {
+            return found ? hit.distance : std::numeric_limits<float>::infinity();
+        });
+        return found;
+    }
+
+    template<class T, template<class> class Behavior, template<class> class Cell, template<class> class Layout>
+    void HierarchicalSpatialGrid<T, Behavior, Cell, Layout>::cast_all(const Ray &ray, RayHits &hits) const
+    {
+        hits.clear();
+        walk(ray, [&](Id id, const AABB &shape)
+        {
+            RayHit hit{id, 0.f};
+            if (this->intersect(ray, shape, hit.distance))
+            {
+                hits.push_back(hit);
+            }
+        }, []()
+        {
+            return std::numeric_limits<float>::infinity();
+        });
+        this->sort_hits(hits);
+    }
+
+    // Sort-and-sweep along x. Changes are collected and the array is re-sorted with insertion sort
+    // on the first query after them, so the cost follows the distance objects moved in the order.
+    template<class T, template<class> class Behavior = CollisionShape>
+    class SweepAndPrune : public BroadAABBCollisionDetector<T, Behavior>
+    {
+    public:
+        using Id = typename T::unique_id_type;
+        using value_type = typename BroadAABBCollisionDetector<T, Behavior>::value_type;
+        using behavior_type = typename BroadAABBCollisionDetector<T, Behavior>::behavior_type;
+        using Size = helpers::containers::Size2D<uint32_t>;
+        using SingleCollisions = typename BroadAABBCollisionDetector<T, Behavior>::SingleCollisions;
+        using CollisionPair = typename BroadAABBCollisionDetector<T, Behavior>::CollisionPair;
+        using PairCollisions = typename BroadAABBCollisionDetector<T, Behavior>::PairCollisions;
+        using Ids = typename BroadAABBCollisionDetector<T, Behavior>::Ids;
+        using IdBuffer = typename BroadAABBCollisionDetector<T, Behavior>::IdBuffer;
+        using PairBuffer = typename BroadAABBCollisionDetector<T, Behavior>::PairBuffer;
+        using Ray = typename BroadAABBCollisionDetector<T, Behavior>::Ray;
+        using RayHit = typename BroadAABBCollisionDetector<T, Behavior>::RayHit;
+        using RayHits = typename BroadAABBCollisionDetector<T, Behavior>::RayHits;
+
+        SweepAndPrune() = default;
+
+        void add(const T &object) override;
+        void remove(const T &object) override;
+        void remove(Id id) override;
+        void update(const T &object) override;
+        void update(Id id) override;
+        using BroadAABBCollisionDetector<T, Behavior>::remove;
+        using BroadAABBCollisionDetector<T, Behavior>::update;
+        using BroadAABBCollisionDetector<T, Behavior>::broad_check;
+        void broad_check(const Point &pt, IdBuffer &result) const override;
+        void broad_check(const Rect &roi, IdBuffer &result) const override;
+        void broad_check(PairBuffer &result) const override;
+        bool cast_first(const Ray &ray, RayHit &hit) const override;
+        void cast_all(const Ray &ray, RayHits &hits) const override;
+        const T *object(Id id) const override;
+        size_t size() const override;
+
+        void set_world_size(const Size &size);
+
+    protected:
+        void collect(std::vector<const T *> &objects) const override;
+
+    private:
+        using Filter = typename BroadAABBCollisionDetector<T, Behavior>::Filter;
+        struct Entry
+        {
+            AABB shape;
+            Id id;
+            const T *object{nullptr};
+            Filter filter;
+        };
+
+        void sort() const;
+        Rect fix_roi(const Rect &roi) const;
+        size_t first_candidate(uint32_t left) const;
+        template<class Visitor>
+        void sweep_ray(const Ray &ray, Visitor visitor) const;
+
+        Size _world_size{0, 0};
+        mutable std::vector<Entry> _entries;
+        mutable std::unordered_map<Id, size_t> _slots;
+        mutable uint32_t _max_width{0};
+        mutable size_t _removed{0};
+        mutable std::atomic<bool> _sorted{true};
+        mutable std::mutex _sort_mutex;
+    };
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::set_world_size(const Size &size)
+    {
+        _world_size = size;
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::add(const T &object)
+    {
+        auto id = object.unique_id();
+        if (_slots.count(id) > 0)
+        {
+            return;
+        }
+        _slots[id] = _entries.size();
+        _entries.push_back({this->get_shape(object), id, &object, this->get_filter(object)});
+        _sorted = false;
+        this->track_add(object);
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::remove(const T &object)
+    {
+        remove(object.unique_id());
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::remove(Id id)
+    {
+        auto slot = _slots.find(id);
+        if (slot == _slots.end())
+        {
+            return;
+        }
+        // NOTE: entry is compacted away by the next sort
+        _entries[slot->second].object = nullptr;
+        _slots.erase(slot);
+        _removed++;
+        _sorted = false;
+        this->track_remove(id);
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::update(const T &object)
+    {
+        update(object.unique_id());
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::update(Id id)
+    {
+        auto slot = _slots.find(id);
+        if (slot == _slots.end())
+        {
+            return;
+        }
+        auto &entry = _entries[slot->second];
+        entry.shape = this->get_shape(*entry.object);
+        entry.filter = this->get_filter(*entry.object);
+        _sorted = false;
+        this->track_update(*entry.object);
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::sort() const
+    {
+        if (_sorted.load(std::memory_order_acquire))
+        {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(_sort_mutex);
+        if (_sorted.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        if (_removed > 0)
+        {
+            auto end = std::remove_if(_entries.begin(), _entries.end(),
+                                      [](const Entry &entry) { return entry.object == nullptr; });
+            _entries.erase(end, _entries.end());
+            _removed = 0;
+            for (size_t i = 0; i < _entries.size(); ++i)
+            {
+                _slots[_entries[i].id] = i;
+            }
+        }
+        _max_width = 0;
+        for (size_t i = 0; i < _entries.size(); ++i)
+        {
+            _max_width = std::max(_max_width, _entries[i].shape.width());
+            auto entry = _entries[i];
+            size_t j = i;
+            while (j > 0 && _entries[j - 1].shape.top_left.x > entry.shape.top_left.x)
+            {
+                _entries[j] = _entries[j - 1];
+                _slots[_entries[j].id] = j;
+                --j;
+            }
+            if (j != i)
+            {
+                _entries[j] = entry;
+                _slots[entry.id] = j;
+            }
+        }
+        _sorted.store(true, std::memory_order_release);
+    }
+
+    template<class T, template<class> class Behavior>
+    Rect SweepAndPrune<T, Behavior>::fix_roi(const Rect &roi) const
+    {
+        return {
+                std::clamp(roi.top_left.y, (uint32_t) 0, _world_size.y),
+                std::clamp(roi.top_left.x, (uint32_t) 0, _world_size.x),
+                std::clamp(roi.bottom_right.y, (uint32_t) 0, _world_size.y),
+                std::clamp(roi.bottom_right.x, (uint32_t) 0, _world_size.x)
+        };
+    }
+
+    template<class T, template<class> class Behavior>
+    size_t SweepAndPrune<T, Behavior>::first_candidate(uint32_t left) const
+    {
+        uint32_t from = left > _max_width ? left - _max_width : 0;
+        auto it = std::lower_bound(_entries.begin(), _entries.end(), from,
+                                   [](const Entry &entry, uint32_t x) { return entry.shape.top_left.x < x; });
+        return (size_t) (it - _entries.begin());
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::broad_check(const Point &pt, IdBuffer &result) const
+    {
+        sort();
+        result.clear();
+        for (size_t i = first_candidate(pt.x); i < _entries.size() && _entries[i].shape.top_left.x < pt.x; ++i)
+        {
+            const auto &shape = _entries[i].shape;
+            if (pt.x < shape.bottom_right.x && pt.x > shape.top_left.x
+                &&
+                pt.y < shape.bottom_right.y && pt.y > shape.top_left.y)
+            {
+                result.push_back(_entries[i].id);
+            }
+        }
+        std::sort(result.begin(), result.end());
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::broad_check(const Roi &roi, IdBuffer &result) const
+    {
+        sort();
+        result.clear();
+        auto fixed_rc = fix_roi(roi);
+        for (size_t i = first_candidate(fixed_rc.top_left.x);
+             i < _entries.size() && _entries[i].shape.top_left.x <= fixed_rc.bottom_right.x; ++i)
+        {
+            if (fixed_rc && _entries[i].shape)
+            {
+                result.push_back(_entries[i].id);
+            }
+        }
+        std::sort(result.begin(), result.end());
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::broad_check(PairBuffer &result) const
+    {
+        sort();
+        auto sweep = [this](size_t begin, size_t end, PairBuffer &buffer)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const auto &entry = _entries[i];
+                bool is_static = entry.object->is_static_shape();
+                for (size_t j = i + 1;
+                     j < _entries.size() && _entries[j].shape.top_left.x <= entry.shape.bottom_right.x; ++j)
+                {
+                    const auto &other = _entries[j];
+                    if (is_static && other.object->is_static_shape())
+                    {
+                        continue;
+                    }
+                    if (entry.shape && other.shape && entry.filter.accepts(other.filter))
+                    {
+                        buffer.push_back(this->make_pair(entry.id, other.id));
+                    }
+                }
+            }
+        };
+        auto pool = this->parallel_pool();
+        if (pool == nullptr)
+        {
+            result.clear();
+            sweep(0, _entries.size(), result);
+            this->sort_unique(result);
+            return;
+        }
+        auto &buffers = this->worker_buffers(pool->size());
+        pool->parallel_for(_entries.size(), [&](size_t begin, size_t end, uint32_t worker)
+        {
+            sweep(begin, end, buffers[worker]);
+        });
+        this->merge_pairs(buffers, result);
+    }
+
+    template<class T, template<class> class Behavior>
+    bool SweepAndPrune<T, Behavior>::cast_first(const Ray &ray, RayHit &hit) const
+    {
+        bool found = false;
+        sweep_ray(ray, [&](const Entry &entry)
+        {
+            RayHit candidate{entry.id, 0.f};
+            if (this->intersect(ray, entry.shape, candidate.distance) && (!found || this->closer(candidate, hit)))
+            {
+                hit = candidate;
+                found = true;
+            }
+        });
+        return found;
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::cast_all(const Ray &ray, RayHits &hits) const
+    {
+        hits.clear();
+        sweep_ray(ray, [&](const Entry &entry)
+        {
+            RayHit hit{entry.id, 0.f};
+            if (this->intersect(ray, entry.shape, hit.distance))
+            {
+                hits.push_back(hit);
+            }
+        });
+        std::sort(hits.begin(), hits.end(), this->closer);
+    }
+
+    template<class T, template<class> class Behavior>
+    const T *SweepAndPrune<T, Behavior>::object(Id id) const
+    {
+        sort();
+        auto slot = _slots.find(id);
+        return slot != _slots.end() ? _entries[slot->second].object : nullptr;
+    }
+
+    template<class T, template<class> class Behavior>
+    size_t SweepAndPrune<T, Behavior>::size() const
+    {
+        return _slots.size();
+    }
+
+    template<class T, template<class> class Behavior>
+    void SweepAndPrune<T, Behavior>::collect(std::vector<const T *> &objects) const
+    {
+        // NOTE: removed entries stay with a null object until the next sort
+        for (const auto &entry: _entries)
+        {
+            if (entry.object != nullptr)
+            {
+                objects.push_back(entry.object);
+            }
+        }
+    }
+
+    // Visits the entries overlapping the x range of the ray
+    template<class T, template<class> class Behavior>
+    template<class Visitor>
+    void SweepAndPrune<T, Behavior>::sweep_ray(const Ray &ray, Visitor visitor) const
+    {
+        sort();
+        auto end_x = ray.origin.x + ray.direction.x * ray.length;
+        auto left = std::max(0.f, std::floor(std::min(ray.origin.x, end_x)));
+        auto right = std::ceil(std::max(ray.origin.x, end_x));
+        if (right < 0.f)
+        {
+            return;
+        }
+        auto last = (uint32_t) std::min(right, (float) std::numeric_limits<uint32_t>::max());
+        for (size_t i = first_candidate((uint32_t) left); i < _entries.size() && _entries[i].shape.top_left.x <= last; ++i)
+        {
+            visitor(_entries[i]);
+        }
+    }
+
+    // Dynamic AABB tree (bounding volume hierarchy) over fattened shapes.
+    // Small moves inside the fat box do not touch the tree, big ones re-insert the leaf with rotations on the way up.
+    template<class T, template<class> class Behavior = CollisionShape>
+    class DynamicAABBTree : public BroadAABBCollisionDetector<T, Behavior>
+    {
+    public:
+        using Id = typename T::unique_id_type;
+        using value_type = typename BroadAABBCollisionDetector<T, Behavior>::value_type;
+        using behavior_type = typename BroadAABBCollisionDetector<T, Behavior>::behavior_type;
+        using Size = helpers::containers::Size2D<uint32_t>;
+        using SingleCollisions = typename BroadAABBCollisionDetector<T, Behavior>::SingleCollisions;
+        using CollisionPair = typename BroadAABBCollisionDetector<T, Behavior>::CollisionPair;
+        using PairCollisions = typename BroadAABBCollisionDetector<T, Behavior>::PairCollisions;
+        using Ids = typename BroadAABBCollisionDetector<T, Behavior>::Ids;
+        using IdBuffer = typename BroadAABBCollisionDetector<T, Behavior>::IdBuffer;
+        using PairBuffer = typename BroadAABBCollisionDetector<T, Behavior>::PairBuffer;
+        using Ray = typename BroadAABBCollisionDetector<T, Behavior>::Ray;
+        using RayHit = typename BroadAABBCollisionDetector<T, Behavior>::RayHit;
+        using RayHits = typename BroadAABBCollisionDetector<T, Behavior>::RayHits;
+
+        DynamicAABBTree() = default;
+
+        void add(const T &object) override;
+        void remove(const T &object) override;
+        void remove(Id id) override;
+        void update(const T &object) override;
+        void update(Id id) override;
+        using BroadAABBCollisionDetector<T, Behavior>::remove;
+        using BroadAABBCollisionDetector<T, Behavior>::update;
+        using BroadAABBCollisionDetector<T, Behavior>::broad_check;
+        void broad_check(const Point &pt, IdBuffer &result) const override;
+        void broad_check(const Rect &roi, IdBuffer &result) const override;
+        void broad_check(PairBuffer &result) const override;
+        bool cast_first(const Ray &ray, RayHit &hit) const override;
+        void cast_all(const Ray &ray, RayHits &hits) const override;
+        const T *object(Id id) const override;
+        size_t size() const override;
+
+        void set_world_size(const Size &size);
+        // NOTE: affects only objects added/re-inserted afterwards
+        void set_margin(uint32_t margin);
+
+    protected:
+        void collect(std::vector<const T *> &objects) const override;
+
+    private:
+        static constexpr int32_t null_node = -1;
+        using Filter = typename BroadAABBCollisionDetector<T, Behavior>::Filter;
+
+        struct Node
+        {
+            AABB box;
+            AABB shape;
+            Filter filter;
+            const T *object{nullptr};
+            int32_t parent{null_node};
+            int32_t left{null_node};
+            int32_t right{null_node};
+            int32_t height{0};
+            bool leaf() const
+            { return left == null_node; }
+        };
+
+        static AABB combine(const AABB &a, const AABB &b);
+        static int64_t perimeter(const AABB &box);
+        AABB fatten(const AABB &shape) const;
+        Rect fix_roi(const Rect &roi) const;
+        int32_t allocate_node();
+        void free_node(int32_t node);
+        void insert_leaf(int32_t leaf);
+        void remove_leaf(int32_t leaf);
+        int32_t balance(int32_t a);
+        void refit(int32_t index);
+        template<class Visitor>
+        void query(const AABB &box, Visitor &&visitor) const;
+        template<class Visitor, class Limit>
+        void query(const Ray &ray, Visitor &&visitor, Limit &&limit) const;
+
+        Size _world_size{0, 0};
+        uint32_t _margin{4};
+        std::vector<Node> _nodes;
+        int32_t _root{null_node};
+        int32_t _free_list{null_node};
+        std::unordered_map<Id, int32_t> _leaves;
+        mutable std::vector<const Node *> _sources;
+    };
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::set_world_size(const Size &size)
+    {
+        _world_size = size;
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::set_margin(uint32_t margin)
+    {
+        _margin = margin;
+    }
+
+    template<class T, template<class> class Behavior>
+    AABB DynamicAABBTree<T, Behavior>::combine(const AABB &a, const AABB &b)
+    {
+        return {
+                std::min(a.top_left.y, b.top_left.y),
+                std::min(a.top_left.x, b.top_left.x),
+                std::max(a.bottom_right.y, b.bottom_right.y),
+                std::max(a.bottom_right.x, b.bottom_right.x)
+        };
+    }
+
+    template<class T, template<class> class Behavior>
+    int64_t DynamicAABBTree<T, Behavior>::perimeter(const AABB &box)
+    {
+        return 2 * ((int64_t) box.width() + (int64_t) box.height());
+    }
+
+    template<class T, template<class> class Behavior>
+    AABB DynamicAABBTree<T, Behavior>::fatten(const AABB &shape) const
+    {
+        constexpr uint32_t max = std::numeric_limits<uint32_t>::max();
+        return {
+                shape.top_left.y > _margin ? shape.top_left.y - _margin : 0,
+                shape.top_left.x > _margin ? shape.top_left.x - _margin : 0,
+                shape.bottom_right.y < max - _margin ? shape.bottom_right.y + _margin : max,
+                shape.bottom_right.x < max - _margin ? shape.bottom_right.x + _margin : max
+        };
+    }
+
+    template<class T, template<class> class Behavior>
+    Rect DynamicAABBTree<T, Behavior>::fix_roi(const Rect &roi) const
+    {
+        return {
+                std::clamp(roi.top_left.y, (uint32_t) 0, _world_size.y),
+                std::clamp(roi.top_left.x, (uint32_t) 0, _world_size.x),
+                std::clamp(roi.bottom_right.y, (uint32_t) 0, _world_size.y),
+                std::clamp(roi.bottom_right.x, (uint32_t) 0, _world_size.x)
+        };
+    }
+
+    template<class T, template<class> class Behavior>
+    int32_t DynamicAABBTree<T, Behavior>::allocate_node()
+    {
+        if (_free_list == null_node)
+        {
+            _nodes.emplace_back();
+            return (int32_t) (_nodes.size() - 1);
+        }
+        auto node = _free_list;
+        _free_list = _nodes[node].parent;
+        _nodes[node] = Node();
+        return node;
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::free_node(int32_t node)
+    {
+        _nodes[node].object = nullptr;
+        _nodes[node].height = -1;
+        _nodes[node].parent = _free_list;
+        _free_list = node;
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::add(const T &object)
+    {
+        auto id = object.unique_id();
+        if (_leaves.count(id) > 0)
+        {
+            return;
+        }
+        auto leaf = allocate_node();
+        auto &node = _nodes[leaf];
+        node.object = &object;
+        node.shape = this->get_shape(object);
+        node.filter = this->get_filter(object);
+        node.box = fatten(node.shape);
+        insert_leaf(leaf);
+        _leaves[id] = leaf;
+        this->track_add(object);
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::remove(const T &object)
+    {
+        remove(object.unique_id());
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::remove(Id id)
+    {
+        auto leaf = _leaves.find(id);
+        if (leaf == _leaves.end())
+        {
+            return;
+        }
+        remove_leaf(leaf->second);
+        free_node(leaf->second);
+        _leaves.erase(leaf);
+        this->track_remove(id);
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::update(const T &object)
+    {
+        update(object.unique_id());
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::update(Id id)
+    {
+        auto leaf = _leaves.find(id);
+        if (leaf == _leaves.end())
+        {
+            return;
+        }
+        auto &node = _nodes[leaf->second];
+        node.shape = this->get_shape(*node.object);
+        node.filter = this->get_filter(*node.object);
+        if (!this->contains(node.box, node.shape))
+        {
+            remove_leaf(leaf->second);
+            _nodes[leaf->second].box = fatten(_nodes[leaf->second].shape);
+            insert_leaf(leaf->second);
+        }
+        this->track_update(*_nodes[leaf->second].object);
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::insert_leaf(int32_t leaf)
+    {
+        if (_root == null_node)
+        {
+            _root = leaf;
+            _nodes[leaf].parent = null_node;
+            return;
+        }
+
+        // find the best sibling: the one with the smallest increase of the total perimeter
+        AABB leaf_box = _nodes[leaf].box;
+        int32_t index = _root;
+        while (!_nodes[index].leaf())
+        {
+            const auto &node = _nodes[index];
+            int64_t area = perimeter(node.box);
+            int64_t combined_area = perimeter(combine(node.box, leaf_box));
+            int64_t cost = 2 * combined_area;
+            int64_t inheritance_cost = 2 * (combined_area - area);
+            auto child_cost = [&](int32_t child)
+            {
+                const auto &child_node = _nodes[child];
+                int64_t new_area = perimeter(combine(leaf_box, child_node.box));
+                if (child_node.leaf())
+                {
+                    return new_area + inheritance_cost;
+                }
+                return new_area - perimeter(child_node.box) + inheritance_cost;
+            };
+            int64_t cost_left = child_cost(node.left);
+            int64_t cost_right = child_cost(node.right);
+            if (cost < cost_left && cost < cost_right)
+            {
+                break;
+            }
+            index = cost_left < cost_right ? node.left : node.right;
+        }
+        int32_t sibling = index;
+
+        int32_t old_parent = _nodes[sibling].parent;
+        int32_t new_parent = allocate_node();
+        _nodes[new_parent].parent = old_parent;
+        _nodes[new_parent].box = combine(leaf_box, _nodes[sibling].box);
+        _nodes[new_parent].height = _nodes[sibling].height + 1;
+        _nodes[new_parent].left = sibling;
+        _nodes[new_parent].right = leaf;
+        _nodes[sibling].parent = new_parent;
+        _nodes[leaf].parent = new_parent;
+        if (old_parent == null_node)
+        {
+            _root = new_parent;
+        }
+        else if (_nodes[old_parent].left == sibling)
+        {
+            _nodes[old_parent].left = new_parent;
+        }
+        else
+        {
+            _nodes[old_parent].right = new_parent;
+        }
+        refit(new_parent);
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::remove_leaf(int32_t leaf)
+    {
+        if (leaf == _root)
+        {
+            _root = null_node;
+            return;
+        }
+        int32_t parent = _nodes[leaf].parent;
+        int32_t grand_parent = _nodes[parent].parent;
+        int32_t sibling = _nodes[parent].left == leaf ? _nodes[parent].right : _nodes[parent].left;
+        free_node(parent);
+        _nodes[sibling].parent = grand_parent;
+        if (grand_parent == null_node)
+        {
+            _root = sibling;
+            return;
+        }
+        if (_nodes[grand_parent].left == parent)
+        {
+            _nodes[grand_parent].left = sibling;
+        }
+        else
+        {
+            _nodes[grand_parent].right = sibling;
+        }
+        refit(grand_parent);
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::refit(int32_t index)
+    {
+        while (index != null_node)
+        {
+            index = balance(index);
+            auto &node = _nodes[index];
+            node.height = 1 + std::max(_nodes[node.left].height, _nodes[node.right].height);
+            node.box = combine(_nodes[node.left].box, _nodes[node.right].box);
+            index = node.parent;
+        }
+    }
+
+    // Rotates the subtree rooted at a if it is imbalanced, returns the new subtree root.
+    template<class T, template<class> class Behavior>
+    int32_t DynamicAABBTree<T, Behavior>::balance(int32_t a)
+    {
+        if (_nodes[a].leaf() || _nodes[a].height < 2)
+        {
+            return a;
+        }
+        int32_t b = _nodes[a].left;
+        int32_t c = _nodes[a].right;
+        int32_t difference = _nodes[c].height - _nodes[b].height;
+        if (difference >= -1 && difference <= 1)
+        {
+            return a;
+        }
+        // promote the higher child (up) and move one of its children (f/g) under a
+        auto rotate = [this, a](int32_t up, int32_t other, bool up_is_right)
+        {
+            int32_t f = _nodes[up].left;
+            int32_t g = _nodes[up].right;
+            _nodes[up].left = a;
+            _nodes[up].parent = _nodes[a].parent;
+            _nodes[a].parent = up;
+            if (_nodes[up].parent != null_node)
+            {
+                auto &parent = _nodes[_nodes[up].parent];
+                if (parent.left == a)
+                {
+                    parent.left = up;
+                }
+                else
+                {
+                    parent.right = up;
+                }
+            }
+            else
+            {
+                _root = up;
+            }
+            int32_t keep = f;
+            int32_t move = g;
+            if (_nodes[f].height <= _nodes[g].height)
+            {
+                keep = g;
+                move = f;
+            }
+            _nodes[up].right = keep;
+            if (up_is_right)
+            {
+                _nodes[a].right = move;
+            }
+            else
+            {
+                _nodes[a].left = move;
+            }
+            _nodes[move].parent = a;
+            _nodes[a].box = combine(_nodes[other].box, _nodes[move].box);
+            _nodes[a].height = 1 + std::max(_nodes[other].height, _nodes[move].height);
+            _nodes[up].box = combine(_nodes[a].box, _nodes[keep].box);
+            _nodes[up].height = 1 + std::max(_nodes[a].height, _nodes[keep].height);
+            return up;
+        };
+        if (difference > 1)
+        {
+            return rotate(c, b, true);
+        }
+        return rotate(b, c, false);
+    }
+
+    template<class T, template<class> class Behavior>
+    template<class Visitor>
+    void DynamicAABBTree<T, Behavior>::query(const AABB &box, Visitor &&visitor) const
+    {
+        if (_root == null_node)
+        {
+            return;
+        }
+        // NOTE: queries may run on several pool workers at once
+        thread_local std::vector<int32_t> stack;
+        stack.clear();
+        stack.push_back(_root);
+        while (!stack.empty())
+        {
+            const auto &node = _nodes[stack.back()];
+            stack.pop_back();
+            if (!(node.box && box))
+            {
+                continue;
+            }
+            if (node.leaf())
+            {
+                visitor(node);
+            }
+            else
+            {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+
+    template<class T, template<class> class Behavior>
+    const T *DynamicAABBTree<T, Behavior>::object(Id id) const
+    {
+        auto leaf = _leaves.find(id);
+        return leaf != _leaves.end() ? _nodes[leaf->second].object : nullptr;
+    }
+
+    template<class T, template<class> class Behavior>
+    size_t DynamicAABBTree<T, Behavior>::size() const
+    {
+        return _leaves.size();
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::collect(std::vector<const T *> &objects) const
+    {
+        for (const auto &[id, leaf]: _leaves)
+        {
+            objects.push_back(_nodes[leaf].object);
+        }
+    }
+
+    // Same as the box query, nodes the ray enters beyond limit() are pruned
+    template<class T, template<class> class Behavior>
+    template<class Visitor, class Limit>
+    void DynamicAABBTree<T, Behavior>::query(const Ray &ray, Visitor &&visitor, Limit &&limit) const
+    {
+        if (_root == null_node)
+        {
+            return;
+        }
+        thread_local std::vector<int32_t> stack;
+        stack.clear();
+        stack.push_back(_root);
+        while (!stack.empty())
+        {
+            const auto &node = _nodes[stack.back()];
+            stack.pop_back();
+            float entry;
+            if (!this->intersect(ray, node.box, entry) || entry > limit())
+            {
+                continue;
+            }
+            if (node.leaf())
+            {
+                visitor(node);
+            }
+            else
+            {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+
+    template<class T, template<class> class Behavior>
+    bool DynamicAABBTree<T, Behavior>::cast_first(const Ray &ray, RayHit &hit) const
+    {
+        bool found = false;
+        query(ray, [&](const Node &node)
+        {
+            RayHit candidate{node.object->unique_id(), 0.f};
+            if (this->intersect(ray, node.shape, candidate.distance) && (!found || this->closer(candidate, hit)))
+            {
+                hit = candidate;
+                found = true;
+            }
+        }, [&]()
+        {
+            return found ? hit.distance : std::numeric_limits<float>::infinity();
+        });
+        return found;
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::cast_all(const Ray &ray, RayHits &hits) const
+    {
+        hits.clear();
+        query(ray, [&](const Node &node)
+        {
+            RayHit hit{node.object->unique_id(), 0.f};
+            if (this->intersect(ray, node.shape, hit.distance))
+            {
+                hits.push_back(hit);
+            }
+        }, []()
+        {
+            return std::numeric_limits<float>::infinity();
+        });
+        std::sort(hits.begin(), hits.end(), this->closer);
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::broad_check(const Point &pt, IdBuffer &result) const
+    {
+        result.clear();
+        query(AABB(pt, pt), [&](const Node &node)
+        {
+            const auto &shape = node.shape;
+            if (pt.x < shape.bottom_right.x && pt.x > shape.top_left.x
+                &&
+                pt.y < shape.bottom_right.y && pt.y > shape.top_left.y)
+            {
+                result.push_back(node.object->unique_id());
+            }
+        });
+        std::sort(result.begin(), result.end());
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::broad_check(const Roi &roi, IdBuffer &result) const
+    {
+        result.clear();
+        auto fixed_rc = fix_roi(roi);
+        query(fixed_rc, [&](const Node &node)
+        {
+            if (fixed_rc && node.shape)
+            {
+                result.push_back(node.object->unique_id());
+            }
+        });
+        std::sort(result.begin(), result.end());
+    }
+
+    template<class T, template<class> class Behavior>
+    void DynamicAABBTree<T, Behavior>::broad_check(PairBuffer &result) const
+    {
+        _sources.clear();
+        for (const auto &item: _leaves)
+        {
+            const auto &node = _nodes[item.second];
+            if (!node.object->is_static_shape())
+            {
+                _sources.push_back(&node);
+            }
+        }
+        auto find_pairs = [this](size_t begin, size_t end, PairBuffer &buffer)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                const auto &source = *_sources[i];
+                auto id = source.object->unique_id();
+                auto fixed_rc = fix_roi(source.shape);
+                query(fixed_rc, [&](const Node &node)
+                {
+                    auto other = node.object->unique_id();
+                    if (other != id && (fixed_rc && node.shape) && source.filter.accepts(node.filter))
+                    {
+                        buffer.push_back(this->make_pair(id, other));
+                    }
+                });
+            }
+        };
+        auto pool = this->parallel_pool();
+        if (pool == nullptr)
+        {
+            result.clear();
+            find_pairs(0, _sources.size(), result);
+            this->sort_unique(result);
+            return;
+        }
+        auto &buffers = this->worker_buffers(pool->size());
+        pool->parallel_for(_sources.size(), [&](size_t begin, size_t end, uint32_t worker)
+        {
+            find_pairs(begin, end, buffers[worker]);
+        });
+        this->merge_pairs(buffers, result);
     }
 }
 #endif //ENGINE_COLLISIONDETECTORS_HPP
@@ -49,6 +49,7 @@ namespace core
         Map _screens;
         Size _screen_size;
         Detector _detector;
+        mutable Detector::IdBuffer _found;
     };
 
     class EventManager
@@ -0,0 +1,54 @@
+#ifndef ENGINE_NARROWPHASE_H
+#define ENGINE_NARROWPHASE_H
+
+#include <array>
+#include <cstdint>
+#include "core/Types.h"
+
+namespace core::narrow_phase
+{
+    // Exact shape of an object in world coordinates. Broad phase still works with AABBs,
+    // so the collision shape of the object should cover bounds() of its exact shape.
+    class Shape
+    {
+    public:
+        enum class Type : uint8_t
+        {
+            AABB,
+            Circle,
+            OrientedBox,
+            Polygon
+        };
+        static constexpr size_t types = 4;
+        static constexpr size_t max_vertices = 8;
+        using Vertices = std::array<PointF, max_vertices>;
+
+        static Shape aabb(const AABB &box);
+        static Shape circle(const PointF &center, float radius);
+        // angle is in radians, clockwise (y axis points down)
+        static Shape oriented_box(const PointF &center, const PointF &half_size, float angle);
+        // Convex polygon with 3..max_vertices vertices in any winding order
+        static Shape polygon(const PointF *vertices, size_t count);
+
+        Type type() const;
+        AABB bounds() const;
+        // Circle only
+        const PointF &center() const;
+        float radius() const;
+        // AABB, OrientedBox and Polygon; clockwise on screen
+        const PointF *vertices() const;
+        size_t vertices_count() const;
+    private:
+        Shape() = default;
+        Type _type{Type::AABB};
+        // NOTE: boxes are kept as polygons too, Circle keeps its center in the first vertex
+        Vertices _vertices;
+        uint8_t _count{0};
+        float _radius{0.f};
+    };
+
+    // Touching shapes intersect, same as AABBs in the broad phase
+    bool intersect(const Shape &lhs, const Shape &rhs);
+}
+
+#endif //ENGINE_NARROWPHASE_H
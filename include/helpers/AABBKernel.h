@@ -0,0 +1,52 @@
+#ifndef ENGINE_AABBKERNEL_H
+#define ENGINE_AABBKERNEL_H
+
+#include <vector>
+#include <cstdint>
+#include "helpers/Containers.hpp"
+
+namespace helpers::containers
+{
+    enum class SimdLevel
+    {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+    // Best level supported by the CPU, detected once at startup
+    SimdLevel simd_level();
+    // NOTE: mostly for benchmarks; levels above the supported one are clamped
+    void set_simd_level(SimdLevel level);
+
+    // Boxes in structure-of-arrays form, tested 4 (SSE2) or 8 (AVX2) at a time.
+    // Every box carries a tag which is reported back on a hit.
+    class AABBBatch
+    {
+    public:
+        using Box = Rect2D<uint32_t>;
+        using Point = Point2D<uint32_t>;
+        using Tags = std::vector<uint32_t>;
+
+        void clear();
+        void reserve(size_t count);
+        void push_back(const Box &box, uint32_t tag);
+        size_t size() const;
+        bool empty() const;
+
+        // Appends tags of boxes intersecting the rect (same rules as Rect2D's operator&&)
+        void intersect(const Box &rc, Tags &tags) const;
+        // Appends tags of boxes strictly containing the point
+        void contain(const Point &pt, Tags &tags) const;
+    private:
+        void select(uint32_t left, uint32_t right, uint32_t top, uint32_t bottom, Tags &tags) const;
+        // NOTE: coordinates are stored with the sign bit flipped, so signed compares give unsigned order
+        std::vector<int32_t> _top;
+        std::vector<int32_t> _left;
+        std::vector<int32_t> _bottom;
+        std::vector<int32_t> _right;
+        Tags _tags;
+    };
+}
+
+#endif //ENGINE_AABBKERNEL_H
@@ -1,11 +1,19 @@
 #ifndef ENGINE_BASICCONTEXT_H
 #define ENGINE_BASICCONTEXT_H
 
+#include <functional>
+#include <tuple>
+#include <memory_resource>
+#include <typeindex>
+#include <unordered_map>
+#include <unordered_set>
 #include "core/Types.h"
 #include "core/Context.h"
 #include "core/CollisionDetectors.hpp"
 #include "core/BasicObjects.h"
 #include "core/Camera.h"
+#include "helpers/Components.hpp"
+#include "helpers/Storage.hpp"
 
 namespace helpers::context
 {
@@ -17,9 +25,16 @@ namespace helpers::context
     {
         friend class WorldManager;
     private:
-        using Item = std::unique_ptr<Object>;
-        using Objects = std::map<Id, Item>;
+        using Item = std::unique_ptr<Object, helpers::storage::PoolDeleter>;
+        // NOTE: map nodes are recycled by _nodes, so creating and removing objects doesn't hit the heap
+        using Objects = std::pmr::map<Id, Item>;
+        using Pools = std::unordered_map<std::type_index, std::unique_ptr<helpers::storage::BlockPool>>;
     public:
+        struct PoolStats
+        {
+            const char *type;
+            helpers::storage::BlockPool::Stats stats;
+        };
         using const_iterator = typename Objects::const_iterator;
         using iterator = typename Objects::iterator;
         Object *get(Id id);
@@ -27,6 +42,10 @@ namespace helpers::context
         const_iterator cend() const;
         iterator begin();
         iterator end();
+        // Objects of each type live in their own pool, freed blocks are reused by the next objects of the type
+        std::vector<PoolStats> pool_stats() const;
+        template<class T>
+        void reserve(size_t count);
         virtual ~ObjectManager() = default;
     protected:
         ObjectManager() = default;
@@ -35,7 +54,12 @@ namespace helpers::context
         void remove(Id id);
         void remove(Object *object);
     private:
-        Objects _objects;
+        template<class T>
+        helpers::storage::BlockPool &pool();
+        // NOTE: pools are declared first, so they outlive the objects
+        Pools _pools;
+        std::pmr::unsynchronized_pool_resource _nodes;
+        Objects _objects{&_nodes};
     };
 
     class WorldManager
@@ -43,16 +67,22 @@ namespace helpers::context
     private:
         using Item = Object *;
         using Objects = std::map<Id, Item>;
+        // NOTE: any BroadAABBCollisionDetector fits here (e.g. collision_detector::SweepAndPrune<T, Behavior>)
         template<class T, template<class> class Behavior>
-        using BroadCollisionDetector = typename core::collision_detector::HierarchicalSpatialGrid<T, Behavior>;
+        using BroadCollisionDetector = typename core::collision_detector::HierarchicalSpatialGrid<T, Behavior, core::collision_detector::FlatCell>;
         using CollisionDetector = BroadCollisionDetector<basic::object::CollidableObject, basic::behavior::CollisionShape>;
         using RenderDetector = BroadCollisionDetector<basic::object::RenderableObject, basic::behavior::RenderShape>;
     public:
         using Collisions = CollisionDetector::PairCollisions;
+        using Impacts = CollisionDetector::Impacts;
+        using Components = helpers::components::ComponentStore;
+        using System = std::function<void(Components &components, uint32_t time_elapsed)>;
+        using Command = std::function<void(WorldManager &manager)>;
         WorldManager(core::ScreenManager &screen_manager, const context::Context* current_context);
         virtual ~WorldManager();
         void set_world_size(const Size &size);
         const Size &world_size() const;
+        // Inside the parallel evaluation the object is made at the end of it and nullptr is returned
         template<class T, class ... Types>
         T *create_object(Types &&... args);
         Object *get_object(Id id);
@@ -60,33 +90,108 @@ namespace helpers::context
         void remove_object(Object *object);
         void initialize_objects();
         void evaluate_objects(uint32_t time_elapsed);
+        // Updates only the objects changed since the last call (see basic::behavior::Changed),
+        // update actors without Changed are asked every time
         void update_objects();
         void clear_collisions();
         void update_cameras();
+        // Reaps the objects died since the last call (see basic::behavior::Dead), no scan over all of the objects
         void check_dead_objects();
+        // Objects of the death note are removed in one batch
         void remove_objects();
         core::Camera *create_camera(const Point &position, const Size &size);
         void remove_camera(core::Camera *camera);
         void remove_camera(Id id);
-        Collisions check_collisions();
+        const Collisions &check_collisions();
+        const Collisions &collisions_began() const;
+        const Collisions &collisions_ended() const;
+        // Contacts of fast shapes along their moves since the last call (see FastShape)
+        const Impacts &check_impacts();
+        // Spatial queries (ray casts, regions, etc.) over collidable objects
+        const CollisionDetector &collision_detector() const;
         ObjectManager& object_manager();
+        // nullptr if there is no such object in the world or it is not collidable, no RTTI involved
+        basic::object::CollidableObject *get_collidable(Id id);
         void set_time_elapsed(uint32_t time_elapsed);
+        void set_collision_threads(uint32_t threads);
+        // Parallel-safe actors (see basic::actor::ParallelSafe) are spread over these threads
+        void set_evaluate_threads(uint32_t threads);
+        // Runs the command at once, or at the end of the parallel evaluation when called inside of it.
+        // NOTE: commands of the parallel evaluation run in the order of the actors, whatever thread made them.
+        void defer(Command command);
+        // Entities have components only, there is no Object behind them
+        Id create_entity();
+        // Deferred as remove_object(), components of objects are removed with them too
+        void remove_entity(Id id);
+        Components &components();
+        // Systems run after the actors are evaluated, in the order they were added
+        void add_system(System system);
+        // Objects with Behavior get the component T, it is pulled before the systems and pushed after them
+        template<class Behavior, class T>
+        void bind_component(typename helpers::components::BehaviorAdapter<Behavior, T>::Pull pull,
+                            typename helpers::components::BehaviorAdapter<Behavior, T>::Push push);
+        void run_systems(uint32_t time_elapsed);
     protected:
         WorldManager() = default;
         void add_object(Object *object);
         void remove_object_impl(Id id);
+        void evaluate_parallel(uint32_t time_elapsed);
+        void load_static_objects();
     private:
+        // true on the threads of the parallel evaluation, structural changes are deferred there
+        static bool deferring();
         struct UpdateInfo
         {
             basic::actor::Update* actor;
             basic::object::CollidableObject* collidable;
             basic::object::RenderableObject* renderable;
             basic::object::Object*           object;
+            basic::behavior::Position*       position;
+            basic::behavior::Changed*        changed;
         };
-        std::list<basic::actor::Initialize  *> _initialization_list;
-        std::map<Id, basic::actor::Evaluate *> _actors_to_evaluate;
-        std::map<Id, UpdateInfo> _objects_to_update;
-        std::set<Id> _death_note;
+        // Where the object is in the per-frame lists, so one lookup by id finds all of them
+        struct Slots
+        {
+            helpers::containers::SlotHandle evaluate;
+            helpers::containers::SlotHandle parallel;
+            helpers::containers::SlotHandle update;
+            helpers::containers::SlotHandle polled;
+            helpers::containers::SlotHandle collidable;
+        };
+        // NOTE: takes a copy, update() may create objects and move the lists
+        void update_object(UpdateInfo update_info);
+        std::vector<basic::actor::Initialize *> _initialization_list;
+        // NOTE: per-frame lists are dense, so frames walk contiguous memory (in the order of adding, not of ids)
+        helpers::containers::SlotMap<basic::actor::Evaluate *> _actors_to_evaluate;
+        helpers::containers::SlotMap<basic::actor::Evaluate *> _parallel_actors;
+        std::unordered_map<Id, Slots> _slots;
+        // One buffer per chunk of _parallel_actors
+        std::vector<std::vector<Command>> _deferred;
+        std::unique_ptr<helpers::threading::ThreadPool> _evaluate_pool;
+        // Objects with Changed are updated when they are queued, the others are polled every time
+        helpers::containers::SlotMap<UpdateInfo> _objects_to_update;
+        helpers::containers::SlotMap<UpdateInfo> _polled_updates;
+        basic::behavior::Changed::Queue _changes;
+        std::vector<Id> _changed_ids;
+        basic::behavior::Dead::Queue _deaths;
+        std::vector<Id> _dead_ids;
+        // NOTE: may hold duplicates, remove_objects() sorts it and moves it to _removing
+        std::vector<Id> _death_note;
+        std::vector<Id> _removing;
+        // NOTE: capabilities are found once in add_object(), so per-frame loops don't cast
+        helpers::containers::SlotMap<basic::object::CollidableObject *> _collidables;
+        std::vector<Id> _collision_updates;
+        std::vector<Id> _render_updates;
+        std::vector<const basic::object::CollidableObject *> _static_collidables;
+        std::vector<const basic::object::RenderableObject *> _static_renderables;
+        Impacts _impacts;
+        Components _components;
+        std::vector<System> _systems;
+        std::vector<std::unique_ptr<helpers::components::IBehaviorAdapter>> _adapters;
+        std::unordered_set<Id> _entities;
+        RenderDetector::IdBuffer _visible_ids;
+        core::Camera::List _visible_objects;
+        std::unique_ptr<helpers::threading::ThreadPool> _thread_pool;
         CollisionDetector _collision_detector;
         RenderDetector _render_detector;
         core::CameraManager _camera_manager;
@@ -125,13 +230,18 @@ namespace helpers::context
     {
     public:
         using Collisions = WorldManager::Collisions;
+        using Impacts = WorldManager::Impacts;
         BasicContext() = delete;
         BasicContext(core::EventManager &event_manager, core::ScreenManager &screen_manager);
         virtual void evaluate(uint32_t time_elapsed) override;
         virtual void act();
         virtual void initialize() override;
         virtual void process_event(const core::Event *event);
-        virtual void process_collisions(Collisions pairs);
+        // NOTE: takes the pairs by const reference since the broad phase keeps them between frames.
+        // Overrides of the former by-value signature no longer get called, declare overrides with override.
+        virtual void process_collisions(const Collisions &pairs);
+        virtual void process_collision_events(const Collisions &began, const Collisions &ended);
+        virtual void process_impacts(const Impacts &impacts);
     protected:
         WorldManager &world_manager();
     private:
@@ -144,17 +254,60 @@ namespace helpers::context
     T *ObjectManager::create(Types &&... args)
     {
         static_assert(std::is_base_of_v<Object, T>, "T should be derived from Object");
-        auto ptr = new T(std::forward<Types>(args)...);
-        auto item = Item(ptr);
+        auto &blocks = pool<T>();
+        auto block = blocks.allocate();
+        T *ptr = nullptr;
+        try
+        {
+            ptr = new(block) T(std::forward<Types>(args)...);
+        }
+        catch (...)
+        {
+            blocks.free(block);
+            throw;
+        }
+        auto item = Item(ptr, helpers::storage::PoolDeleter(&blocks));
         _objects.emplace(item->unique_id(), std::move(item));
         return ptr;
     }
 
+    template<class T>
+    helpers::storage::BlockPool &ObjectManager::pool()
+    {
+        auto &blocks = _pools[std::type_index(typeid(T))];
+        if (!blocks)
+        {
+            blocks.reset(new helpers::storage::BlockPool(sizeof(T), alignof(T)));
+        }
+        return *blocks;
+    }
+
+    template<class T>
+    void ObjectManager::reserve(size_t count)
+    {
+        static_assert(std::is_base_of_v<Object, T>, "T should be derived from Object");
+        pool<T>().reserve(count);
+    }
+
     template<class T, class... Types>
     T *WorldManager::create_object(Types &&... args)
     {
+        if (deferring())
+        {
+            // NOTE: ObjectManager and the lists are not thread-safe, arguments are kept until the sync point
+            auto values = std::make_shared<std::tuple<std::decay_t<Types>...>>(std::forward<Types>(args)...);
+            defer([values](WorldManager &manager)
+                  {
+                      std::apply([&manager](auto &... items)
+                                 {
+                                     manager.create_object<T>(std::move(items)...);
+                                 }, *values);
+                  });
+            return nullptr;
+        }
         auto ptr = _object_manager.create<T>(std::forward<Types>(args)...);
         ptr->set_world_manager(this);
+        ptr->set_death_queue(&_deaths, ptr->unique_id());
         if constexpr (std::is_base_of_v<basic::actor::Initialize, T>)
         {
             LOG_D("Added %d to initialization list", ptr->unique_id())
@@ -166,6 +319,18 @@ namespace helpers::context
         }
         return ptr;
     }
+
+    template<class Behavior, class T>
+    void WorldManager::bind_component(typename helpers::components::BehaviorAdapter<Behavior, T>::Pull pull,
+                                      typename helpers::components::BehaviorAdapter<Behavior, T>::Push push)
+    {
+        auto adapter = new helpers::components::BehaviorAdapter<Behavior, T>(pull, push);
+        _adapters.emplace_back(adapter);
+        for (auto &[id, object]: _object_manager)
+        {
+            adapter->attach(id, object.get());
+        }
+    }
 }
 
 #endif //ENGINE_BASICCONTEXT_H
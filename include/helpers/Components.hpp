@@ -0,0 +1,424 @@
+#ifndef ENGINE_COMPONENTS_HPP
+#define ENGINE_COMPONENTS_HPP
+
+#include <tuple>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "core/Types.h"
+#include "core/BasicBehaviors.hpp"
+
+namespace helpers::components
+{
+    class IComponentArray
+    {
+    public:
+        virtual ~IComponentArray() = default;
+        virtual void remove(Id id) = 0;
+        virtual size_t size() const = 0;
+    };
+
+    // Components of one type packed without holes, entity(i) owns the i-th component.
+    // NOTE: add and remove move components around, so pointers and indices are valid until the next one.
+    template<class T>
+    class ComponentArray : public IComponentArray
+    {
+    public:
+        using iterator = typename std::vector<T>::iterator;
+        using const_iterator = typename std::vector<T>::const_iterator;
+        // Replaces the component if the entity has one
+        T &add(Id id, const T &component = T());
+        void remove(Id id) override;
+        bool contains(Id id) const;
+        // Index of the component of the entity, size() if it has none
+        size_t index(Id id) const;
+        T *get(Id id);
+        const T *get(Id id) const;
+        size_t size() const override;
+        bool empty() const;
+        void reserve(size_t count);
+        Id entity(size_t index) const;
+        const std::vector<Id> &entities() const;
+        T *data();
+        const T *data() const;
+        iterator begin();
+        iterator end();
+        const_iterator cbegin() const;
+        const_iterator cend() const;
+    private:
+        std::vector<T> _components;
+        std::vector<Id> _entities;
+        std::unordered_map<Id, uint32_t> _index;
+    };
+
+    // Entities are plain ids, each component type has its own dense array
+    class ComponentStore
+    {
+    public:
+        template<class T>
+        ComponentArray<T> &components();
+        // nullptr if no component of the type was ever added
+        template<class T>
+        const ComponentArray<T> *find_components() const;
+        template<class T>
+        T &add(Id id, const T &component = T());
+        template<class T>
+        T *get(Id id);
+        template<class T>
+        const T *get(Id id) const;
+        template<class T>
+        void remove(Id id);
+        // Removes all components of the entity
+        void remove(Id id);
+        void clear();
+        // function(id, first, rest...) for every entity having all of the components, in the order of First.
+        // NOTE: components must not be added or removed inside, First is the one to iterate, so the rarest is the best.
+        // A Rest component at the same index as the First one is taken directly, otherwise it costs a hash lookup,
+        // so arrays filled in the same order are the cheapest.
+        template<class First, class ... Rest, class Function>
+        void each(Function &&function);
+    private:
+        template<class T>
+        static size_t type_index();
+        static size_t next_type_index();
+        std::vector<std::unique_ptr<IComponentArray>> _arrays;
+    };
+
+    class IBehaviorAdapter
+    {
+    public:
+        virtual ~IBehaviorAdapter() = default;
+        virtual void attach(Id id, core::basic::behavior::IBehavior *object) = 0;
+        virtual void detach(Id id) = 0;
+        // behaviors -> components
+        virtual void pull(ComponentStore &store) = 0;
+        // components -> behaviors
+        virtual void push(ComponentStore &store) = 0;
+    };
+
+    // Mirrors a behavior of the objects into a component, so systems see objects which are not migrated yet
+    template<class Behavior, class T>
+    class BehaviorAdapter : public IBehaviorAdapter
+    {
+    public:
+        using Pull = void (*)(const Behavior &behavior, T &component);
+        using Push = void (*)(Behavior &behavior, const T &component);
+        BehaviorAdapter(Pull pull, Push push);
+        void attach(Id id, core::basic::behavior::IBehavior *object) override;
+        void detach(Id id) override;
+        void pull(ComponentStore &store) override;
+        void push(ComponentStore &store) override;
+    private:
+        // NOTE: index of the component is checked against the entity before use and looked up again
+        // only after a removal moved the component
+        struct Binding
+        {
+            Id id;
+            Behavior *behavior;
+            uint32_t index;
+        };
+        static bool bound(const ComponentArray<T> &components, const Binding &binding);
+        Pull _pull;
+        Push _push;
+        std::vector<Binding> _bindings;
+        std::unordered_map<Id, uint32_t> _index;
+    };
+
+    // =================================================================================================
+
+    template<class T>
+    T &ComponentArray<T>::add(Id id, const T &component)
+    {
+        auto item = _index.find(id);
+        if (item != _index.end())
+        {
+            return _components[item->second] = component;
+        }
+        _index.emplace(id, (uint32_t) _components.size());
+        _entities.push_back(id);
+        _components.push_back(component);
+        return _components.back();
+    }
+
+    template<class T>
+    void ComponentArray<T>::remove(Id id)
+    {
+        auto item = _index.find(id);
+        if (item == _index.end())
+        {
+            return;
+        }
+        auto index = item->second;
+        _index.erase(item);
+        if (index + 1 != _components.size())
+        {
+            _components[index] = std::move(_components.back());
+            _entities[index] = _entities.back();
+            _index[_entities[index]] = index;
+        }
+        _components.pop_back();
+        _entities.pop_back();
+    }
+
+    template<class T>
+    bool ComponentArray<T>::contains(Id id) const
+    {
+        return _index.count(id) > 0;
+    }
+
+    template<class T>
+    size_t ComponentArray<T>::index(Id id) const
+    {
+        auto item = _index.find(id);
+        return item != _index.end() ? item->second : _components.size();
+    }
+
+    template<class T>
+    T *ComponentArray<T>::get(Id id)
+    {
+        auto item = _index.find(id);
+        return item != _index.end() ? &_components[item->second] : nullptr;
+    }
+
+    template<class T>
+    const T *ComponentArray<T>::get(Id id) const
+    {
+        auto item = _index.find(id);
+        return item != _index.end() ? &_components[item->second] : nullptr;
+    }
+
+    template<class T>
+    size_t ComponentArray<T>::size() const
+    {
+        return _components.size();
+    }
+
+    template<class T>
+    bool ComponentArray<T>::empty() const
+    {
+        return _components.empty();
+    }
+
+    template<class T>
+    void ComponentArray<T>::reserve(size_t count)
+    {
+        _components.reserve(count);
+        _entities.reserve(count);
+        _index.reserve(count);
+    }
+
+    template<class T>
+    Id ComponentArray<T>::entity(size_t index) const
+    {
+        return _entities[index];
+    }
+
+    template<class T>
+    const std::vector<Id> &ComponentArray<T>::entities() const
+    {
+        return _entities;
+    }
+
+    template<class T>
+    T *ComponentArray<T>::data()
+    {
+        return _components.data();
+    }
+
+    template<class T>
+    const T *ComponentArray<T>::data() const
+    {
+        return _components.data();
+    }
+
+    template<class T>
+    typename ComponentArray<T>::iterator ComponentArray<T>::begin()
+    {
+        return _components.begin();
+    }
+
+    template<class T>
+    typename ComponentArray<T>::iterator ComponentArray<T>::end()
+    {
+        return _components.end();
+    }
+
+    template<class T>
+    typename ComponentArray<T>::const_iterator ComponentArray<T>::cbegin() const
+    {
+        return _components.cbegin();
+    }
+
+    template<class T>
+    typename ComponentArray<T>::const_iterator ComponentArray<T>::cend() const
+    {
+        return _components.cend();
+    }
+
+    template<class T>
+    size_t ComponentStore::type_index()
+    {
+        static const size_t index = next_type_index();
+        return index;
+    }
+
+    template<class T>
+    ComponentArray<T> &ComponentStore::components()
+    {
+        auto index = type_index<T>();
+        if (index >= _arrays.size())
+        {
+            _arrays.resize(index + 1);
+        }
+        auto &array = _arrays[index];
+        if (!array)
+        {
+            array.reset(new ComponentArray<T>);
+        }
+        return static_cast<ComponentArray<T> &>(*array);
+    }
+
+    template<class T>
+    const ComponentArray<T> *ComponentStore::find_components() const
+    {
+        auto index = type_index<T>();
+        if (index >= _arrays.size())
+        {
+            return nullptr;
+        }
+        return static_cast<const ComponentArray<T> *>(_arrays[index].get());
+    }
+
+    template<class T>
+    T &ComponentStore::add(Id id, const T &component)
+    {
+        return components<T>().add(id, component);
+    }
+
+    template<class T>
+    T *ComponentStore::get(Id id)
+    {
+        return components<T>().get(id);
+    }
+
+    template<class T>
+    const T *ComponentStore::get(Id id) const
+    {
+        auto array = find_components<T>();
+        return array != nullptr ? array->get(id) : nullptr;
+    }
+
+    template<class T>
+    void ComponentStore::remove(Id id)
+    {
+        components<T>().remove(id);
+    }
+
+    template<class First, class ... Rest, class Function>
+    void ComponentStore::each(Function &&function)
+    {
+        auto &first = components<First>();
+        auto arrays = std::make_tuple(&components<Rest>()...);
+        for (size_t i = 0; i < first.size(); ++i)
+        {
+            auto id = first.entity(i);
+            auto rest = std::apply([id, i](auto *... array)
+                                   {
+                                       return std::make_tuple((i < array->size() && array->entity(i) == id ?
+                                                               array->data() + i : array->get(id))...);
+                                   }, arrays);
+            bool complete = std::apply([](auto *... component)
+                                       {
+                                           return (... && (component != nullptr));
+                                       }, rest);
+            if (complete)
+            {
+                std::apply([&](auto *... component)
+                           {
+                               function(id, first.data()[i], *component...);
+                           }, rest);
+            }
+        }
+    }
+
+    template<class Behavior, class T>
+    BehaviorAdapter<Behavior, T>::BehaviorAdapter(Pull pull, Push push)
+            :
+            _pull(pull),
+            _push(push)
+    {}
+
+    template<class Behavior, class T>
+    void BehaviorAdapter<Behavior, T>::attach(Id id, core::basic::behavior::IBehavior *object)
+    {
+        auto behavior = dynamic_cast<Behavior *>(object);
+        if (behavior == nullptr || _index.count(id) > 0)
+        {
+            return;
+        }
+        _index.emplace(id, (uint32_t) _bindings.size());
+        _bindings.push_back({id, behavior, 0});
+    }
+
+    template<class Behavior, class T>
+    void BehaviorAdapter<Behavior, T>::detach(Id id)
+    {
+        auto item = _index.find(id);
+        if (item == _index.end())
+        {
+            return;
+        }
+        auto index = item->second;
+        _index.erase(item);
+        if (index + 1 != _bindings.size())
+        {
+            _bindings[index] = _bindings.back();
+            _index[_bindings[index].id] = index;
+        }
+        _bindings.pop_back();
+    }
+
+    template<class Behavior, class T>
+    bool BehaviorAdapter<Behavior, T>::bound(const ComponentArray<T> &components, const Binding &binding)
+    {
+        return binding.index < components.size() && components.entity(binding.index) == binding.id;
+    }
+
+    template<class Behavior, class T>
+    void BehaviorAdapter<Behavior, T>::pull(ComponentStore &store)
+    {
+        auto &components = store.components<T>();
+        for (auto &binding: _bindings)
+        {
+            if (!bound(components, binding))
+            {
+                binding.index = (uint32_t) components.index(binding.id);
+                if (binding.index == components.size())
+                {
+                    components.add(binding.id);
+                }
+            }
+            _pull(*binding.behavior, components.data()[binding.index]);
+        }
+    }
+
+    template<class Behavior, class T>
+    void BehaviorAdapter<Behavior, T>::push(ComponentStore &store)
+    {
+        auto &components = store.components<T>();
+        for (auto &binding: _bindings)
+        {
+            if (!bound(components, binding))
+            {
+                binding.index = (uint32_t) components.index(binding.id);
+                if (binding.index == components.size())
+                {
+                    continue;
+                }
+            }
+            _push(*binding.behavior, components.data()[binding.index]);
+        }
+    }
+}
+
+#endif //ENGINE_COMPONENTS_HPP
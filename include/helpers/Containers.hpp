@@ -3,6 +3,10 @@
 #include <memory>
 #include <numeric>
 #include <cmath>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
 
 namespace helpers::containers
 {
@@ -586,5 +590,288 @@ namespace helpers::containers
             return const_iterator(*this, _dimensions[0]);
         }
     }
+
+    // Ids pushed from any thread, read by one thread when nobody pushes. push() takes a slot with one atomic
+    // increment, slots which do not fit go to a locked list, and the slots grow to fit them on the next take().
+    template<class T>
+    class IdQueue
+    {
+    public:
+        IdQueue() = default;
+        IdQueue(const IdQueue &) = delete;
+        IdQueue &operator=(const IdQueue &) = delete;
+        void push(T id);
+        // Moves the queued ids to ids (in the order they were pushed, unless some did not fit)
+        void take(std::vector<T> &ids);
+        size_t size() const;
+        bool empty() const;
+        void reserve(size_t count);
+    private:
+        std::vector<T> _ids;
+        std::atomic<size_t> _size{0};
+        std::mutex _mutex;
+        std::vector<T> _overflow;
+    };
+
+    template<class T>
+    void IdQueue<T>::push(T id)
+    {
+        auto index = _size.fetch_add(1, std::memory_order_relaxed);
+        if (index < _ids.size())
+        {
+            _ids[index] = id;
+            return;
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _overflow.push_back(id);
+    }
+
+    template<class T>
+    void IdQueue<T>::take(std::vector<T> &ids)
+    {
+        auto count = _size.load(std::memory_order_acquire);
+        ids.assign(_ids.begin(), _ids.begin() + std::min(count, _ids.size()));
+        ids.insert(ids.end(), _overflow.begin(), _overflow.end());
+        _overflow.clear();
+        reserve(count);
+        _size.store(0, std::memory_order_relaxed);
+    }
+
+    template<class T>
+    size_t IdQueue<T>::size() const
+    {
+        return _size.load(std::memory_order_relaxed);
+    }
+
+    template<class T>
+    bool IdQueue<T>::empty() const
+    {
+        return size() == 0;
+    }
+
+    template<class T>
+    void IdQueue<T>::reserve(size_t count)
+    {
+        if (count > _ids.size())
+        {
+            _ids.resize(count);
+        }
+    }
+
+    struct SlotHandle
+    {
+        static constexpr uint32_t invalid = ~uint32_t(0);
+        uint32_t index{invalid};
+        uint32_t generation{0};
+        bool valid() const
+        { return index != invalid; }
+        bool operator==(const SlotHandle &other) const
+        { return index == other.index && generation == other.generation; }
+        bool operator!=(const SlotHandle &other) const
+        { return !(*this == other); }
+    };
+
+    // Values packed without holes, handles stay valid until their value is removed.
+    // NOTE: remove() moves the last value into the hole, so the order of values changes and pointers to them
+    // are valid until the next emplace() or remove(). Handles of removed values are never valid again.
+    template<class T>
+    class SlotMap
+    {
+    public:
+        using Handle = SlotHandle;
+        using iterator = typename std::vector<T>::iterator;
+        using const_iterator = typename std::vector<T>::const_iterator;
+        template<class ... Types>
+        Handle emplace(Types &&... args);
+        // false if the handle is not valid
+        bool remove(Handle handle);
+        bool contains(Handle handle) const;
+        // nullptr if the handle is not valid
+        T *get(Handle handle);
+        const T *get(Handle handle) const;
+        // The index-th value and its handle, index < size()
+        T &value(size_t index);
+        const T &value(size_t index) const;
+        Handle handle(size_t index) const;
+        size_t size() const;
+        bool empty() const;
+        void clear();
+        void reserve(size_t count);
+        T *data();
+        const T *data() const;
+        iterator begin();
+        iterator end();
+        const_iterator begin() const;
+        const_iterator end() const;
+    private:
+        struct Slot
+        {
+            // Index of the value, or the next free slot
+            uint32_t index;
+            uint32_t generation;
+        };
+        void release(uint32_t slot);
+        std::vector<T> _values;
+        // Slot of each value
+        std::vector<uint32_t> _owners;
+        std::vector<Slot> _slots;
+        uint32_t _free{Handle::invalid};
+    };
+
+    template<class T>
+    template<class ... Types>
+    SlotHandle SlotMap<T>::emplace(Types &&... args)
+    {
+        _values.emplace_back(std::forward<Types>(args)...);
+        uint32_t slot = _free;
+        if (slot != Handle::invalid)
+        {
+            _free = _slots[slot].index;
+        }
+        else
+        {
+            slot = (uint32_t) _slots.size();
+            _slots.push_back({0, 1});
+        }
+        _slots[slot].index = (uint32_t) _owners.size();
+        _owners.push_back(slot);
+        return {slot, _slots[slot].generation};
+    }
+
+    template<class T>
+    bool SlotMap<T>::remove(Handle handle)
+    {
+        if (!contains(handle))
+        {
+            return false;
+        }
+        auto index = _slots[handle.index].index;
+        if (index + 1 != _values.size())
+        {
+            _values[index] = std::move(_values.back());
+            _owners[index] = _owners.back();
+            _slots[_owners[index]].index = index;
+        }
+        _values.pop_back();
+        _owners.pop_back();
+        release(handle.index);
+        return true;
+    }
+
+    template<class T>
+    void SlotMap<T>::release(uint32_t slot)
+    {
+        // NOTE: generation 0 is never given out, so default handles never match
+        if (++_slots[slot].generation == 0)
+        {
+            _slots[slot].generation = 1;
+        }
+        _slots[slot].index = _free;
+        _free = slot;
+    }
+
+    template<class T>
+    bool SlotMap<T>::contains(Handle handle) const
+    {
+        return handle.index < _slots.size() && _slots[handle.index].generation == handle.generation;
+    }
+
+    template<class T>
+    T *SlotMap<T>::get(Handle handle)
+    {
+        return contains(handle) ? &_values[_slots[handle.index].index] : nullptr;
+    }
+
+    template<class T>
+    const T *SlotMap<T>::get(Handle handle) const
+    {
+        return contains(handle) ? &_values[_slots[handle.index].index] : nullptr;
+    }
+
+    template<class T>
+    T &SlotMap<T>::value(size_t index)
+    {
+        return _values[index];
+    }
+
+    template<class T>
+    const T &SlotMap<T>::value(size_t index) const
+    {
+        return _values[index];
+    }
+
+    template<class T>
+    SlotHandle SlotMap<T>::handle(size_t index) const
+    {
+        auto slot = _owners[index];
+        return {slot, _slots[slot].generation};
+    }
+
+    template<class T>
+    size_t SlotMap<T>::size() const
+    {
+        return _values.size();
+    }
+
+    template<class T>
+    bool SlotMap<T>::empty() const
+    {
+        return _values.empty();
+    }
+
+    template<class T>
+    void SlotMap<T>::clear()
+    {
+        for (auto slot: _owners)
+        {
+            release(slot);
+        }
+        _values.clear();
+        _owners.clear();
+    }
+
+    template<class T>
+    void SlotMap<T>::reserve(size_t count)
+    {
+        _values.reserve(count);
+        _owners.reserve(count);
+        _slots.reserve(count);
+    }
+
+    template<class T>
+    T *SlotMap<T>::data()
+    {
+        return _values.data();
+    }
+
+    template<class T>
+    const T *SlotMap<T>::data() const
+    {
+        return _values.data();
+    }
+
+    template<class T>
+    typename SlotMap<T>::iterator SlotMap<T>::begin()
+    {
+        return _values.begin();
+    }
+
+    template<class T>
+    typename SlotMap<T>::iterator SlotMap<T>::end()
+    {
+        return _values.end();
+    }
+
+    template<class T>
+    typename SlotMap<T>::const_iterator SlotMap<T>::begin() const
+    {
+        return _values.begin();
+    }
+
+    template<class T>
+    typename SlotMap<T>::const_iterator SlotMap<T>::end() const
+    {
+        return _values.end();
+    }
 }
 #endif //UTILITY_CONTAINERS_HPP
@@ -1,6 +1,9 @@
 #ifndef ENGINE_STORAGE_H
 #define ENGINE_STORAGE_H
 
+#include <cstddef>
+#include <vector>
+
 namespace helpers::storage
 {
     class ProxyStorage
@@ -30,6 +33,66 @@ namespace helpers::storage
             ProxyStorage::remove(p);
         }
     };
+
+    // Free-list of equally sized blocks. Memory is taken in chunks and is given back only with the pool,
+    // so freed blocks are reused without touching the heap.
+    class BlockPool
+    {
+    public:
+        struct Stats
+        {
+            size_t block_size;
+            size_t capacity; // blocks in all chunks
+            size_t used;
+            size_t chunks;
+        };
+        BlockPool(size_t block_size, size_t block_align);
+        BlockPool(const BlockPool &) = delete;
+        BlockPool &operator=(const BlockPool &) = delete;
+        ~BlockPool();
+        void *allocate();
+        void free(void *block);
+        // Makes room for count blocks in use at once
+        void reserve(size_t count);
+        Stats stats() const;
+    private:
+        struct FreeBlock
+        {
+            FreeBlock *next;
+        };
+        void add_chunk(size_t blocks);
+        size_t _block_size;
+        size_t _block_align;
+        std::vector<void *> _chunks;
+        FreeBlock *_free{nullptr};
+        size_t _capacity{0};
+        size_t _used{0};
+    };
+
+    // Destroys an object and gives its block back to the pool it came from
+    class PoolDeleter
+    {
+    public:
+        PoolDeleter() = default;
+        explicit PoolDeleter(BlockPool *pool)
+                :
+                _pool(pool)
+        {}
+        template<class T>
+        void operator()(T *p)
+        {
+            if (p == nullptr)
+            {
+                return;
+            }
+            // NOTE: T may be a (virtual) base, the block starts at the most derived object
+            auto block = dynamic_cast<void *>(p);
+            p->~T();
+            _pool->free(block);
+        }
+    private:
+        BlockPool *_pool{nullptr};
+    };
 }
 
 
@@ -0,0 +1,110 @@
+#ifndef ENGINE_THREADPOOL_H
+#define ENGINE_THREADPOOL_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+namespace helpers::threading
+{
+    // Fork-join pool: the calling thread takes part in every job as worker 0.
+    class ThreadPool
+    {
+    public:
+        using Job = std::function<void(uint32_t worker)>;
+        explicit ThreadPool(uint32_t threads = std::thread::hardware_concurrency());
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+        virtual ~ThreadPool();
+        uint32_t size() const;
+        void run(const Job &job);
+        template<class Function>
+        void parallel_for(size_t count, Function &&function);
+        template<class Function>
+        void parallel_for_dynamic(size_t count, size_t grain, Function &&function);
+    private:
+        // Chunks [next, end) left to a worker, others steal from it when they run out of their own
+        struct alignas(64) Range
+        {
+            std::atomic<size_t> next{0};
+            size_t end{0};
+        };
+        void worker_loop(uint32_t worker);
+        std::unique_ptr<Range[]> _ranges;
+        std::vector<std::thread> _threads;
+        std::mutex _mutex;
+        std::condition_variable _start;
+        std::condition_variable _done;
+        const Job *_job{nullptr};
+        uint64_t _generation{0};
+        uint32_t _pending{0};
+        bool _stop{false};
+    };
+
+    // =================================================================================================
+
+    // function(begin, end, worker) is called once per worker with a contiguous chunk of [0, count)
+    template<class Function>
+    void ThreadPool::parallel_for(size_t count, Function &&function)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        size_t workers = size();
+        size_t chunk = (count + workers - 1) / workers;
+        run([&](uint32_t worker)
+            {
+                size_t begin = worker * chunk;
+                size_t end = std::min(count, begin + chunk);
+                if (begin < end)
+                {
+                    function(begin, end, worker);
+                }
+            });
+    }
+
+    // function(begin, end, worker) is called for chunks of at most grain items of [0, count), chunk i starts at
+    // i * grain. Every worker starts with its own share of chunks and then steals the ones others have not taken,
+    // so uneven chunks do not leave workers idle.
+    template<class Function>
+    void ThreadPool::parallel_for_dynamic(size_t count, size_t grain, Function &&function)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        grain = std::max(grain, (size_t) 1);
+        size_t workers = size();
+        size_t chunks = (count + grain - 1) / grain;
+        for (size_t worker = 0; worker < workers; ++worker)
+        {
+            _ranges[worker].next.store(worker * chunks / workers, std::memory_order_relaxed);
+            _ranges[worker].end = (worker + 1) * chunks / workers;
+        }
+        run([&](uint32_t worker)
+            {
+                for (size_t i = 0; i < workers; ++i)
+                {
+                    auto &range = _ranges[(worker + i) % workers];
+                    while (true)
+                    {
+                        auto chunk = range.next.fetch_add(1, std::memory_order_relaxed);
+                        if (chunk >= range.end)
+                        {
+                            break;
+                        }
+                        size_t begin = chunk * grain;
+                        function(begin, std::min(count, begin + grain), worker);
+                    }
+                }
+            });
+    }
+}
+
+#endif //ENGINE_THREADPOOL_H
@@ -0,0 +1,218 @@
+#include "helpers/AABBKernel.h"
+#include <limits>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ENGINE_AABB_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+using namespace helpers::containers;
+
+namespace
+{
+    struct Arrays
+    {
+        const int32_t *top;
+        const int32_t *left;
+        const int32_t *bottom;
+        const int32_t *right;
+        const uint32_t *tags;
+        size_t count;
+    };
+
+    // A box is selected if right >= left_bound, left <= right_bound, bottom >= top_bound and top <= bottom_bound
+    struct Bounds
+    {
+        int32_t left;
+        int32_t right;
+        int32_t top;
+        int32_t bottom;
+    };
+
+    using Kernel = void (*)(const Arrays &arrays, const Bounds &bounds, AABBBatch::Tags &tags);
+
+    int32_t flip(uint32_t value)
+    {
+        return (int32_t) (value ^ 0x80000000u);
+    }
+
+    void select_scalar(const Arrays &arrays, const Bounds &bounds, size_t begin, AABBBatch::Tags &tags)
+    {
+        for (size_t i = begin; i < arrays.count; ++i)
+        {
+            if (arrays.right[i] >= bounds.left && arrays.left[i] <= bounds.right &&
+                arrays.bottom[i] >= bounds.top && arrays.top[i] <= bounds.bottom)
+            {
+                tags.push_back(arrays.tags[i]);
+            }
+        }
+    }
+
+    void kernel_scalar(const Arrays &arrays, const Bounds &bounds, AABBBatch::Tags &tags)
+    {
+        select_scalar(arrays, bounds, 0, tags);
+    }
+
+#ifdef ENGINE_AABB_KERNEL_X86
+    __attribute__((target("sse2")))
+    void kernel_sse2(const Arrays &arrays, const Bounds &bounds, AABBBatch::Tags &tags)
+    {
+        const __m128i left = _mm_set1_epi32(bounds.left);
+        const __m128i right = _mm_set1_epi32(bounds.right);
+        const __m128i top = _mm_set1_epi32(bounds.top);
+        const __m128i bottom = _mm_set1_epi32(bounds.bottom);
+        size_t i = 0;
+        for (; i + 4 <= arrays.count; i += 4)
+        {
+            auto miss = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpgt_epi32(left, _mm_loadu_si128((const __m128i *) (arrays.right + i))),
+                                 _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *) (arrays.left + i)), right)),
+                    _mm_or_si128(_mm_cmpgt_epi32(top, _mm_loadu_si128((const __m128i *) (arrays.bottom + i))),
+                                 _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i *) (arrays.top + i)), bottom)));
+            auto hits = ~_mm_movemask_ps(_mm_castsi128_ps(miss)) & 0xF;
+            while (hits != 0)
+            {
+                tags.push_back(arrays.tags[i + __builtin_ctz(hits)]);
+                hits &= hits - 1;
+            }
+        }
+        select_scalar(arrays, bounds, i, tags);
+    }
+
+    __attribute__((target("avx2")))
+    void kernel_avx2(const Arrays &arrays, const Bounds &bounds, AABBBatch::Tags &tags)
+    {
+        const __m256i left = _mm256_set1_epi32(bounds.left);
+        const __m256i right = _mm256_set1_epi32(bounds.right);
+        const __m256i top = _mm256_set1_epi32(bounds.top);
+        const __m256i bottom = _mm256_set1_epi32(bounds.bottom);
+        size_t i = 0;
+        for (; i + 8 <= arrays.count; i += 8)
+        {
+            auto miss = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_cmpgt_epi32(left, _mm256_loadu_si256((const __m256i *) (arrays.right + i))),
+                                    _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *) (arrays.left + i)), right)),
+                    _mm256_or_si256(_mm256_cmpgt_epi32(top, _mm256_loadu_si256((const __m256i *) (arrays.bottom + i))),
+                                    _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *) (arrays.top + i)), bottom)));
+            auto hits = ~_mm256_movemask_ps(_mm256_castsi256_ps(miss)) & 0xFF;
+            while (hits != 0)
+            {
+                tags.push_back(arrays.tags[i + __builtin_ctz(hits)]);
+                hits &= hits - 1;
+            }
+        }
+        select_scalar(arrays, bounds, i, tags);
+    }
+#endif
+
+    SimdLevel supported_level()
+    {
+#ifdef ENGINE_AABB_KERNEL_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return SimdLevel::AVX2;
+        }
+        if (__builtin_cpu_supports("sse2"))
+        {
+            return SimdLevel::SSE2;
+        }
+#endif
+        return SimdLevel::Scalar;
+    }
+
+    Kernel kernel_for(SimdLevel level)
+    {
+#ifdef ENGINE_AABB_KERNEL_X86
+        switch (level)
+        {
+            case SimdLevel::AVX2:
+                return kernel_avx2;
+            case SimdLevel::SSE2:
+                return kernel_sse2;
+            default:
+                break;
+        }
+#endif
+        return kernel_scalar;
+    }
+
+    const SimdLevel max_level = supported_level();
+    SimdLevel current_level = max_level;
+    Kernel current_kernel = kernel_for(max_level);
+}
+
+SimdLevel helpers::containers::simd_level()
+{
+    return current_level;
+}
+
+void helpers::containers::set_simd_level(SimdLevel level)
+{
+    current_level = std::min(level, max_level);
+    current_kernel = kernel_for(current_level);
+}
+
+void AABBBatch::clear()
+{
+    _top.clear();
+    _left.clear();
+    _bottom.clear();
+    _right.clear();
+    _tags.clear();
+}
+
+void AABBBatch::reserve(size_t count)
+{
+    _top.reserve(count);
+    _left.reserve(count);
+    _bottom.reserve(count);
+    _right.reserve(count);
+    _tags.reserve(count);
+}
+
+void AABBBatch::push_back(const Box &box, uint32_t tag)
+{
+    _top.push_back(flip(box.top_left.y));
+    _left.push_back(flip(box.top_left.x));
+    _bottom.push_back(flip(box.bottom_right.y));
+    _right.push_back(flip(box.bottom_right.x));
+    _tags.push_back(tag);
+}
+
+size_t AABBBatch::size() const
+{
+    return _tags.size();
+}
+
+bool AABBBatch::empty() const
+{
+    return _tags.empty();
+}
+
+void AABBBatch::intersect(const Box &rc, Tags &tags) const
+{
+    select(rc.top_left.x, rc.bottom_right.x, rc.top_left.y, rc.bottom_right.y, tags);
+}
+
+void AABBBatch::contain(const Point &pt, Tags &tags) const
+{
+    constexpr auto max = std::numeric_limits<uint32_t>::max();
+    // left < x < right  <=>  right >= x + 1 and left <= x - 1
+    if (pt.x == 0 || pt.y == 0 || pt.x == max || pt.y == max)
+    {
+        return;
+    }
+    select(pt.x + 1, pt.x - 1, pt.y + 1, pt.y - 1, tags);
+}
+
+void AABBBatch::select(uint32_t left, uint32_t right, uint32_t top, uint32_t bottom, Tags &tags) const
+{
+    if (_tags.empty())
+    {
+        return;
+    }
+    Arrays arrays{_top.data(), _left.data(), _bottom.data(), _right.data(), _tags.data(), _tags.size()};
+    current_kernel(arrays, {flip(left), flip(right), flip(top), flip(bottom)}, tags);
+}
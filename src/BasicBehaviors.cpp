@@ -10,6 +10,15 @@ const Point &Position::position() const
 void Position::set_position(const Point& position)
 {
     _position = position;
+    if (_changed != nullptr)
+    {
+        _changed->set_changed(true);
+    }
+}
+
+void Position::track_changes(Changed *changed)
+{
+    _changed = changed;
 }
 int32_t Z_Order::z_order() const
 {
@@ -24,6 +33,33 @@ void Z_Order::set_z_order(int32_t z_order)
 void Changed::set_changed(bool changed)
 {
     _changed = changed;
+    if (changed && _queue != nullptr && !_queued)
+    {
+        _queued = true;
+        _queue->push(_queue_id);
+    }
+}
+
+void Changed::set_change_queue(Queue *queue, Id id)
+{
+    _queue = queue;
+    _queue_id = id;
+    _queued = false;
+    if (_changed && _queue != nullptr)
+    {
+        _queued = true;
+        _queue->push(_queue_id);
+    }
+}
+
+bool Changed::queued() const
+{
+    return _queued;
+}
+
+void Changed::unqueue()
+{
+    _queued = false;
 }
 
 bool Changed::changed() const
@@ -33,7 +69,25 @@ bool Changed::changed() const
 
 void Dead::set_dead()
 {
+    if (_dead)
+    {
+        return;
+    }
     _dead = true;
+    if (_queue != nullptr)
+    {
+        _queue->push(_queue_id);
+    }
+}
+
+void Dead::set_death_queue(Queue *queue, Id id)
+{
+    _queue = queue;
+    _queue_id = id;
+    if (_dead && _queue != nullptr)
+    {
+        _queue->push(_queue_id);
+    }
 }
 
 bool Dead::dead() const
@@ -80,3 +134,61 @@ void StaticShape::set_static_shape(bool static_shape)
 {
     _static = static_shape;
 }
+
+bool FastShape::is_fast_shape() const
+{
+    return _fast;
+}
+
+void FastShape::set_fast_shape(bool fast_shape)
+{
+    _fast = fast_shape;
+}
+
+uint32_t CollisionFilter::collision_layer() const
+{
+    return _layer;
+}
+
+void CollisionFilter::set_collision_layer(uint32_t layer)
+{
+    _layer = layer;
+    if (_changed != nullptr)
+    {
+        _changed->set_changed(true);
+    }
+}
+
+uint32_t CollisionFilter::collision_mask() const
+{
+    return _mask;
+}
+
+void CollisionFilter::set_collision_mask(uint32_t mask)
+{
+    _mask = mask;
+    if (_changed != nullptr)
+    {
+        _changed->set_changed(true);
+    }
+}
+
+void CollisionFilter::track_changes(Changed *changed)
+{
+    _changed = changed;
+}
+
+const NarrowShape::narrow_shape_type *NarrowShape::narrow_shape() const
+{
+    return _narrow_shape ? &*_narrow_shape : nullptr;
+}
+
+void NarrowShape::set_narrow_shape(const narrow_shape_type &shape)
+{
+    _narrow_shape = shape;
+}
+
+void NarrowShape::reset_narrow_shape()
+{
+    _narrow_shape.reset();
+}
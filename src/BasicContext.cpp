@@ -4,6 +4,27 @@
 using namespace helpers::context;
 using namespace core;
 
+namespace
+{
+    // Parallel-safe actors are evaluated in chunks of this size
+    constexpr size_t evaluate_grain = 64;
+    // Buffer of the chunk evaluated by this thread, nullptr outside of the parallel evaluation
+    thread_local std::vector<WorldManager::Command> *deferred_commands = nullptr;
+
+    // Broad phase reports overlapping collision shapes, exact shapes are checked here
+    bool narrow_check(const basic::object::CollidableObject *obj1, const basic::object::CollidableObject *obj2)
+    {
+        auto shape1 = obj1->narrow_shape();
+        auto shape2 = obj2->narrow_shape();
+        if (shape1 == nullptr && shape2 == nullptr)
+        {
+            return true;
+        }
+        return narrow_phase::intersect(shape1 != nullptr ? *shape1 : narrow_phase::Shape::aabb(obj1->collision_shape()),
+                                       shape2 != nullptr ? *shape2 : narrow_phase::Shape::aabb(obj2->collision_shape()));
+    }
+}
+
 void ObjectManager::remove(Id id)
 {
     _objects.erase(id);
@@ -46,12 +67,23 @@ ObjectManager::iterator ObjectManager::end()
     return _objects.end();
 }
 
+std::vector<ObjectManager::PoolStats> ObjectManager::pool_stats() const
+{
+    std::vector<PoolStats> result;
+    for (const auto &[type, blocks]: _pools)
+    {
+        result.push_back({type.name(), blocks->stats()});
+    }
+    return result;
+}
+
 WorldManager::WorldManager(core::ScreenManager &screen_manager, const context::Context* current_context)
         :
         _screen_manager(screen_manager),
         _current_context(current_context)
 {
     _camera_manager.set_current_context(_current_context);
+    _collision_detector.set_pair_cache(true);
 }
 
 WorldManager::~WorldManager()
@@ -61,6 +93,10 @@ WorldManager::~WorldManager()
         core::Camera *camera = item.second.get();
         _screen_manager.detach_camera(camera);
     }
+    for (auto id: _entities)
+    {
+        utils::UniqueIdGenerator<Id>::free(id);
+    }
 }
 
 Object *WorldManager::get_object(Id id)
@@ -84,38 +120,93 @@ void WorldManager::add_object(Object *object)
 {
     LOG_D("Added %d to the world.", object->unique_id())
 
+    auto &slots = _slots[object->unique_id()];
+    // NOTE: static objects are loaded into detectors in bulk by initialize_objects()
     auto collidable = dynamic_cast<basic::object::CollidableObject *>(object);
     if (collidable != nullptr)
     {
-        _collision_detector.add(*collidable);
+        slots.collidable = _collidables.emplace(collidable);
+        if (collidable->is_static_shape())
+        {
+            _static_collidables.push_back(collidable);
+        }
+        else
+        {
+            _collision_detector.add(*collidable);
+        }
         LOG_D("Added %d to collision_detector.", collidable->unique_id())
     }
 
     auto renderable = dynamic_cast<basic::object::RenderableObject *>(object);
     if (renderable != nullptr)
     {
-        _render_detector.add(*renderable);
+        if (renderable->is_static_shape())
+        {
+            _static_renderables.push_back(renderable);
+        }
+        else
+        {
+            _render_detector.add(*renderable);
+        }
         LOG_D("Added %d to render_detector.", renderable->unique_id())
     }
 
     auto evaluatable = dynamic_cast<basic::actor::Evaluate *>(object);
-    if (evaluatable != nullptr)
+    if (dynamic_cast<basic::actor::ParallelSafe *>(object) != nullptr)
     {
-        _actors_to_evaluate[object->unique_id()] = evaluatable;
+        slots.parallel = _parallel_actors.emplace(evaluatable);
+        LOG_D("Added %d to parallel evaluate-list.", object->unique_id())
+    }
+    else if (evaluatable != nullptr)
+    {
+        slots.evaluate = _actors_to_evaluate.emplace(evaluatable);
         LOG_D("Added %d to evaluate-list.", renderable->unique_id())
     }
 
     auto updatable = dynamic_cast<basic::actor::Update *>(object);
     if (updatable != nullptr)
     {
-        _objects_to_update[object->unique_id()] = {updatable, collidable, renderable, object};
+        auto position = dynamic_cast<basic::behavior::Position *>(object);
+        auto changed = dynamic_cast<basic::behavior::Changed *>(object);
+        UpdateInfo update_info{updatable, collidable, renderable, object, position, changed};
+        if (changed != nullptr)
+        {
+            slots.update = _objects_to_update.emplace(update_info);
+            if (position != nullptr)
+            {
+                position->track_changes(changed);
+            }
+            auto filter = dynamic_cast<basic::behavior::CollisionFilter *>(object);
+            if (filter != nullptr)
+            {
+                filter->track_changes(changed);
+            }
+            changed->set_change_queue(&_changes, object->unique_id());
+        }
+        else
+        {
+            slots.polled = _polled_updates.emplace(update_info);
+        }
         LOG_D("Added %d to update-list.", renderable->unique_id())
     }
+
+    for (auto &adapter: _adapters)
+    {
+        adapter->attach(object->unique_id(), object);
+    }
 }
 
 void WorldManager::remove_object(Id id)
 {
-    _death_note.insert(id);
+    if (deferred_commands != nullptr)
+    {
+        deferred_commands->push_back([id](WorldManager &manager)
+                                     {
+                                         manager.remove_object(id);
+                                     });
+        return;
+    }
+    _death_note.push_back(id);
     LOG_D("Object %d added to death note.", id)
 }
 
@@ -134,20 +225,50 @@ void WorldManager::remove_objects()
     {
         return;
     }
-    for (auto id: _death_note)
+    // NOTE: objects removed while removing (e.g. by destructors) go to the next batch
+    _removing.swap(_death_note);
+    std::sort(_removing.begin(), _removing.end());
+    _removing.erase(std::unique(_removing.begin(), _removing.end()), _removing.end());
+    auto pending = [this](const auto *object)
+    {
+        return std::binary_search(_removing.begin(), _removing.end(), object->unique_id());
+    };
+    _static_collidables.erase(std::remove_if(_static_collidables.begin(), _static_collidables.end(), pending),
+                              _static_collidables.end());
+    _static_renderables.erase(std::remove_if(_static_renderables.begin(), _static_renderables.end(), pending),
+                              _static_renderables.end());
+    _collision_detector.remove(_removing);
+    _render_detector.remove(_removing);
+    for (auto id: _removing)
     {
         remove_object_impl(id);
     }
-    _death_note.clear();
+    _removing.clear();
 }
 
+// NOTE: pending static objects and detectors are handled by remove_objects() for the whole batch
 void WorldManager::remove_object_impl(Id id)
 {
-    _actors_to_evaluate.erase(id);
-    _objects_to_update.erase(id);
-    _collision_detector.remove(id);
-    _render_detector.remove(id);
+    auto slots = _slots.find(id);
+    if (slots != _slots.end())
+    {
+        _actors_to_evaluate.remove(slots->second.evaluate);
+        _parallel_actors.remove(slots->second.parallel);
+        _objects_to_update.remove(slots->second.update);
+        _polled_updates.remove(slots->second.polled);
+        _collidables.remove(slots->second.collidable);
+        _slots.erase(slots);
+    }
+    for (auto &adapter: _adapters)
+    {
+        adapter->detach(id);
+    }
+    _components.remove(id);
     _object_manager.remove(id);
+    if (_entities.erase(id) > 0)
+    {
+        utils::UniqueIdGenerator<Id>::free(id);
+    }
 }
 
 void WorldManager::set_time_elapsed(uint32_t time_elapsed)
@@ -155,99 +276,256 @@ void WorldManager::set_time_elapsed(uint32_t time_elapsed)
     _time_elapsed = time_elapsed;
 }
 
+void WorldManager::set_collision_threads(uint32_t threads)
+{
+    if (threads < 2)
+    {
+        _collision_detector.set_thread_pool(nullptr);
+        _thread_pool.reset();
+        return;
+    }
+    _thread_pool.reset(new helpers::threading::ThreadPool(threads));
+    _collision_detector.set_thread_pool(_thread_pool.get());
+}
+
+void WorldManager::set_evaluate_threads(uint32_t threads)
+{
+    if (threads < 2)
+    {
+        _evaluate_pool.reset();
+        return;
+    }
+    _evaluate_pool.reset(new helpers::threading::ThreadPool(threads));
+}
+
+bool WorldManager::deferring()
+{
+    return deferred_commands != nullptr;
+}
+
+void WorldManager::defer(Command command)
+{
+    if (deferred_commands != nullptr)
+    {
+        deferred_commands->push_back(std::move(command));
+        return;
+    }
+    command(*this);
+}
+
 void WorldManager::evaluate_objects(uint32_t time_elapsed)
 {
-    for (auto&[id, actor]: _actors_to_evaluate)
+    // NOTE: objects created by actors are evaluated in this frame too, removing is deferred to remove_objects()
+    for (size_t i = 0; i < _actors_to_evaluate.size(); ++i)
     {
-        actor->evaluate(time_elapsed);
+        _actors_to_evaluate.value(i)->evaluate(time_elapsed);
     }
+    evaluate_parallel(time_elapsed);
+    run_systems(time_elapsed);
 }
-void WorldManager::clear_collisions()
+
+void WorldManager::evaluate_parallel(uint32_t time_elapsed)
 {
-    for (auto&[id, object]: _object_manager)
+    auto count = _parallel_actors.size();
+    if (count == 0)
+    {
+        return;
+    }
+    if (!_evaluate_pool)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            _parallel_actors.value(i)->evaluate(time_elapsed);
+        }
+        return;
+    }
+    auto chunks = (count + evaluate_grain - 1) / evaluate_grain;
+    if (_deferred.size() < chunks)
+    {
+        _deferred.resize(chunks);
+    }
+    _evaluate_pool->parallel_for_dynamic(count, evaluate_grain, [this, time_elapsed](size_t begin, size_t end, uint32_t)
     {
-        auto collidable = dynamic_cast<basic::object::CollidableObject*>(object.get());
-        if (collidable != nullptr)
+        deferred_commands = &_deferred[begin / evaluate_grain];
+        for (size_t i = begin; i < end; ++i)
         {
-            collidable->clear_collisions();
+            _parallel_actors.value(i)->evaluate(time_elapsed);
         }
+        deferred_commands = nullptr;
+    });
+    // NOTE: sync point, structural changes are made on this thread only
+    for (size_t chunk = 0; chunk < chunks; ++chunk)
+    {
+        for (auto &command: _deferred[chunk])
+        {
+            command(*this);
+        }
+        _deferred[chunk].clear();
     }
 }
 
-void WorldManager::update_objects()
+Id WorldManager::create_entity()
+{
+    auto id = utils::UniqueIdGenerator<Id>::generate();
+    _entities.insert(id);
+    return id;
+}
+
+void WorldManager::remove_entity(Id id)
+{
+    remove_object(id);
+}
+
+WorldManager::Components &WorldManager::components()
+{
+    return _components;
+}
+
+void WorldManager::add_system(System system)
+{
+    _systems.push_back(std::move(system));
+}
+
+void WorldManager::run_systems(uint32_t time_elapsed)
 {
-    if (_objects_to_update.empty())
+    if (_systems.empty())
     {
         return;
     }
-    struct DetectorUpdateInfo
+    for (auto &adapter: _adapters)
     {
-        basic::object::CollidableObject *collidable;
-        basic::object::RenderableObject *renderable;
-        basic::object::Object *object;
-    };
-    std::list<DetectorUpdateInfo> detector_updates;
-    for (auto&[id, update_info]: _objects_to_update)
+        adapter->pull(_components);
+    }
+    for (auto &system: _systems)
     {
-        auto&[actor, collidable, renderable, object] = update_info;
-        if (actor->update(false) && (collidable != nullptr || renderable != nullptr))
-        {
-            detector_updates.push_back({collidable, renderable, object});
-        }
+        system(_components, time_elapsed);
     }
+    for (auto &adapter: _adapters)
+    {
+        adapter->push(_components);
+    }
+}
+void WorldManager::clear_collisions()
+{
+    for (auto collidable: _collidables)
+    {
+        collidable->clear_collisions();
+    }
+}
 
-    for (auto &[collidable, renderable, object]: detector_updates)
+void WorldManager::update_objects()
+{
+    load_static_objects();
+    _changes.take(_changed_ids);
+    if (_changed_ids.empty() && _polled_updates.empty())
     {
-        auto object_with_pos = dynamic_cast<basic::behavior::Position *>(object);
-        if (object_with_pos != nullptr)
+        return;
+    }
+    _collision_updates.clear();
+    _render_updates.clear();
+    // NOTE: parallel actors push in any order, sorted ids keep updates the same from run to run
+    std::sort(_changed_ids.begin(), _changed_ids.end());
+    for (auto id: _changed_ids)
+    {
+        auto slots = _slots.find(id);
+        if (slots == _slots.end())
         {
-            auto &pos = object_with_pos->position();
-            if (pos.x >= _world_size.x || pos.y >= _world_size.y)
-            {
-                LOG_D("Mr. Anderson tried to escape matrix (unsuccessfully)...")
-                object->set_dead();
-                continue;
-            }
+            continue;
         }
-        if (collidable != nullptr)
+        auto item = _objects_to_update.get(slots->second.update);
+        if (item == nullptr)
         {
-            _collision_detector.update(collidable->unique_id());
+            continue;
         }
-        if (renderable != nullptr)
+        auto update_info = *item;
+        // NOTE: changes the object makes to itself while updating are taken by this update
+        update_object(update_info);
+        update_info.changed->unqueue();
+    }
+    for (size_t i = 0; i < _polled_updates.size(); ++i)
+    {
+        update_object(_polled_updates.value(i));
+    }
+    _collision_detector.update(_collision_updates);
+    _render_detector.update(_render_updates);
+}
+
+void WorldManager::update_object(UpdateInfo update_info)
+{
+    auto&[actor, collidable, renderable, object, position, changed] = update_info;
+    if (!actor->update(false) || (collidable == nullptr && renderable == nullptr))
+    {
+        return;
+    }
+    if (position != nullptr)
+    {
+        auto &pos = position->position();
+        if (pos.x >= _world_size.x || pos.y >= _world_size.y)
         {
-            _render_detector.update(renderable->unique_id());
+            LOG_D("Mr. Anderson tried to escape matrix (unsuccessfully)...")
+            object->set_dead();
+            return;
         }
     }
+    if (collidable != nullptr)
+    {
+        _collision_updates.push_back(collidable->unique_id());
+    }
+    if (renderable != nullptr)
+    {
+        _render_updates.push_back(renderable->unique_id());
+    }
 }
 
 void WorldManager::check_dead_objects()
 {
-    for (auto& [id, object]: _object_manager)
+    // NOTE: die() may kill other objects, they are reaped in this call too
+    for (_deaths.take(_dead_ids); !_dead_ids.empty(); _deaths.take(_dead_ids))
     {
-        if (object->dead())
+        // NOTE: parallel actors push in any order, sorted ids keep die() calls the same from run to run
+        std::sort(_dead_ids.begin(), _dead_ids.end());
+        for (auto id: _dead_ids)
         {
-            auto die = dynamic_cast<basic::actor::Die *>(object.get());
+            auto object = _object_manager.get(id);
+            if (object == nullptr)
+            {
+                continue;
+            }
+            auto die = dynamic_cast<basic::actor::Die *>(object);
             if (die != nullptr)
             {
                 die->die();
             }
-            remove_object(object->unique_id());
+            remove_object(id);
         }
     }
 }
 
 void WorldManager::initialize_objects()
 {
-    if (_initialization_list.empty())
-    {
-        return;
-    }
-    for (auto &object: _initialization_list)
+    // NOTE: initialize() may create objects, they are initialized in this call too
+    for (size_t i = 0; i < _initialization_list.size(); ++i)
     {
+        auto object = _initialization_list[i];
         object->initialize();
         add_object(dynamic_cast<Object *>(object));
     }
     _initialization_list.clear();
+    load_static_objects();
+}
+
+void WorldManager::load_static_objects()
+{
+    if (!_static_collidables.empty())
+    {
+        _collision_detector.add_static(_static_collidables);
+        _static_collidables.clear();
+    }
+    if (!_static_renderables.empty())
+    {
+        _render_detector.add_static(_static_renderables);
+        _static_renderables.clear();
+    }
 }
 
 WorldManager &BasicContext::world_manager()
@@ -255,9 +533,31 @@ WorldManager &BasicContext::world_manager()
     return _world_manager;
 }
 
-WorldManager::Collisions WorldManager::check_collisions()
+const WorldManager::Collisions &WorldManager::check_collisions()
+{
+    _collision_detector.update_pairs();
+    return _collision_detector.pairs();
+}
+
+const WorldManager::Collisions &WorldManager::collisions_began() const
 {
-    return _collision_detector.broad_check();
+    return _collision_detector.pairs_began();
+}
+
+const WorldManager::Collisions &WorldManager::collisions_ended() const
+{
+    return _collision_detector.pairs_ended();
+}
+
+const WorldManager::Impacts &WorldManager::check_impacts()
+{
+    _collision_detector.sweep(_impacts);
+    return _impacts;
+}
+
+const WorldManager::CollisionDetector &WorldManager::collision_detector() const
+{
+    return _collision_detector;
 }
 
 ObjectManager &WorldManager::object_manager()
@@ -265,6 +565,17 @@ ObjectManager &WorldManager::object_manager()
     return _object_manager;
 }
 
+basic::object::CollidableObject *WorldManager::get_collidable(Id id)
+{
+    auto slots = _slots.find(id);
+    if (slots == _slots.end())
+    {
+        return nullptr;
+    }
+    auto collidable = _collidables.get(slots->second.collidable);
+    return collidable != nullptr ? *collidable : nullptr;
+}
+
 core::Camera *WorldManager::create_camera(const Point &position, const Size &size)
 {
     Size fixed_size{
@@ -303,17 +614,17 @@ void WorldManager::update_cameras()
             Point cam_pos = camera->position();
             Point cam_size = camera->size();
             Roi roi{cam_pos, cam_pos + cam_size};
-            auto collisions = _render_detector.broad_check(roi);
-            typename core::Camera::List list;
-            for (const auto &id: collisions)
+            _render_detector.broad_check(roi, _visible_ids);
+            _visible_objects.clear();
+            for (const auto &id: _visible_ids)
             {
-                auto renderable = dynamic_cast<typename core::Camera::ObjectType>(_object_manager.get(id));
+                core::Camera::ObjectType renderable = _render_detector.object(id);
                 if (renderable != nullptr)
                 {
-                    list.push_back(renderable);
+                    _visible_objects.push_back(renderable);
                 }
             }
-            camera->update_visible_objects(std::move(list));
+            camera->update_visible_objects(std::move(_visible_objects));
         }
     }
 }
@@ -342,6 +653,8 @@ void BasicContext::evaluate(uint32_t time_elapsed)
     // TODO: check copy elision
     // Check collisions
     process_collisions(world_manager().check_collisions());
+    process_collision_events(world_manager().collisions_began(), world_manager().collisions_ended());
+    process_impacts(world_manager().check_impacts());
     // Call evaluate
     world_manager().evaluate_objects(time_elapsed);
     // Call update and update collision detectors
@@ -373,12 +686,16 @@ void BasicContext::act()
 {
 
 }
-void BasicContext::process_collisions(BasicContext::Collisions pairs)
+void BasicContext::process_collisions(const BasicContext::Collisions &pairs)
 {
     for (const auto&[id1, id2]: pairs)
     {
-        auto obj1 = dynamic_cast<basic::object::CollidableObject *>(world_manager().get_object(id1));
-        auto obj2 = dynamic_cast<basic::object::CollidableObject *>(world_manager().get_object(id2));
+        auto obj1 = world_manager().get_collidable(id1);
+        auto obj2 = world_manager().get_collidable(id2);
+        if (obj1 != nullptr && obj2 != nullptr && !narrow_check(obj1, obj2))
+        {
+            continue;
+        }
         if (obj1 != nullptr && !obj1->is_static_shape())
         {
             obj1->get_collisions().push_back(obj2);
@@ -390,6 +707,46 @@ void BasicContext::process_collisions(BasicContext::Collisions pairs)
     }
 }
 
+void BasicContext::process_collision_events(const BasicContext::Collisions &/*began*/,
+                                            const BasicContext::Collisions &/*ended*/)
+{
+}
+
+void BasicContext::process_impacts(const BasicContext::Impacts &impacts)
+{
+    // NOTE: fast shapes may pass through an object within one update, so impacts are reported as collisions too
+    auto add = [](basic::object::CollidableObject *obj, const basic::object::CollidableObject *other, float time)
+    {
+        if (obj == nullptr || obj->is_static_shape())
+        {
+            return;
+        }
+        auto &obj_impacts = obj->get_impacts();
+        auto impact = std::find_if(obj_impacts.begin(), obj_impacts.end(), [other](const auto &item)
+        {
+            return item.object == other;
+        });
+        if (impact != obj_impacts.end())
+        {
+            impact->time = std::min(impact->time, time);
+            return;
+        }
+        obj_impacts.push_back({other, time});
+        auto &collisions = obj->get_collisions();
+        if (std::find(collisions.begin(), collisions.end(), other) == collisions.end())
+        {
+            collisions.push_back(other);
+        }
+    };
+    for (const auto &impact: impacts)
+    {
+        auto obj1 = world_manager().get_collidable(impact.fast);
+        auto obj2 = world_manager().get_collidable(impact.other);
+        add(obj1, obj2, impact.time);
+        add(obj2, obj1, impact.time);
+    }
+}
+
 void BasicContext::process_event(const core::Event *event)
 {
 }
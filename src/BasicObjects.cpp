@@ -17,9 +17,15 @@ const CollidableObject::Collisions& CollidableObject::collisions() const
     return _collisions;
 }
 
+const CollidableObject::Impacts& CollidableObject::impacts() const
+{
+    return _impacts;
+}
+
 void CollidableObject::clear_collisions()
 {
     _collisions.clear();
+    _impacts.clear();
 }
 
 CollidableObject::Collisions& CollidableObject::get_collisions()
@@ -27,3 +33,8 @@ CollidableObject::Collisions& CollidableObject::get_collisions()
     return _collisions;
 }
 
+CollidableObject::Impacts& CollidableObject::get_impacts()
+{
+    return _impacts;
+}
+
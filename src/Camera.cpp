@@ -34,9 +34,10 @@ bool Camera::active()
     return _screens_attached > 0;
 }
 
+// NOTE: swaps, so the caller gets the previous list back and can reuse its storage
 void Camera::update_visible_objects(List &&list)
 {
-    _objects = std::move(list);
+    _objects.swap(list);
 }
 
 const void *Camera::current_context() const
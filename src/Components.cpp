@@ -0,0 +1,26 @@
+#include "helpers/Components.hpp"
+
+using namespace helpers::components;
+
+size_t ComponentStore::next_type_index()
+{
+    // NOTE: lives in the engine library, so contexts loaded at runtime get the same indices
+    static size_t next = 0;
+    return next++;
+}
+
+void ComponentStore::remove(Id id)
+{
+    for (auto &array: _arrays)
+    {
+        if (array)
+        {
+            array->remove(id);
+        }
+    }
+}
+
+void ComponentStore::clear()
+{
+    _arrays.clear();
+}
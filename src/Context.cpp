@@ -81,12 +81,12 @@ const Size& ScreenManager::screen_size() const
 
 const Screen *ScreenManager::find_screen(const Point &point) const
 {
-    auto screens = _detector.broad_check(point);
-    if (screens.empty())
+    _detector.broad_check(point, _found);
+    if (_found.empty())
     {
         return nullptr;
     }
-    auto id = *(--screens.end());
+    auto id = _found.back();
     auto screen = _screens.find(id);
     return screen->second.get();
 }
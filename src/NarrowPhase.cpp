@@ -0,0 +1,245 @@
+#include "core/NarrowPhase.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace core::narrow_phase;
+
+namespace
+{
+    float cross(const PointF &a, const PointF &b)
+    {
+        return a.x * b.y - a.y * b.x;
+    }
+
+    float dot(const PointF &a, const PointF &b)
+    {
+        return a.x * b.x + a.y * b.y;
+    }
+
+    // Boxes have parallel sides, so only the first two edges give separating axes
+    size_t axes_count(const Shape &shape)
+    {
+        return shape.type() == Shape::Type::Polygon ? shape.vertices_count() : 2;
+    }
+
+    void project(const Shape &shape, const PointF &axis, float &min, float &max)
+    {
+        const auto *vertices = shape.vertices();
+        min = max = dot(vertices[0], axis);
+        for (size_t i = 1; i < shape.vertices_count(); ++i)
+        {
+            auto value = dot(vertices[i], axis);
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+    }
+
+    bool separated(const Shape &shape, const Shape &other)
+    {
+        const auto *vertices = shape.vertices();
+        auto count = shape.vertices_count();
+        for (size_t i = 0; i < axes_count(shape); ++i)
+        {
+            auto edge = vertices[(i + 1) % count] - vertices[i];
+            PointF axis(edge.y, -edge.x);
+            float min, max, other_min, other_max;
+            project(shape, axis, min, max);
+            project(other, axis, other_min, other_max);
+            if (max < other_min || other_max < min)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool aabb_aabb(const Shape &lhs, const Shape &rhs)
+    {
+        // vertices go from the top left corner clockwise
+        const auto &a_min = lhs.vertices()[0];
+        const auto &a_max = lhs.vertices()[2];
+        const auto &b_min = rhs.vertices()[0];
+        const auto &b_max = rhs.vertices()[2];
+        return a_max.x >= b_min.x && b_max.x >= a_min.x && a_max.y >= b_min.y && b_max.y >= a_min.y;
+    }
+
+    bool polygon_polygon(const Shape &lhs, const Shape &rhs)
+    {
+        return !separated(lhs, rhs) && !separated(rhs, lhs);
+    }
+
+    bool circle_circle(const Shape &lhs, const Shape &rhs)
+    {
+        auto distance = lhs.center() - rhs.center();
+        auto radius = lhs.radius() + rhs.radius();
+        return dot(distance, distance) <= radius * radius;
+    }
+
+    bool circle_polygon(const Shape &circle, const Shape &polygon)
+    {
+        const auto &center = circle.center();
+        const auto *vertices = polygon.vertices();
+        auto count = polygon.vertices_count();
+        bool inside = true;
+        float distance = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < count; ++i)
+        {
+            const auto &from = vertices[i];
+            auto edge = vertices[(i + 1) % count] - from;
+            auto offset = center - from;
+            inside = inside && cross(edge, offset) >= 0.f;
+            auto t = std::clamp(dot(offset, edge) / dot(edge, edge), 0.f, 1.f);
+            auto closest = offset - PointF(edge.x * t, edge.y * t);
+            distance = std::min(distance, dot(closest, closest));
+        }
+        return inside || distance <= circle.radius() * circle.radius();
+    }
+
+    bool polygon_circle(const Shape &polygon, const Shape &circle)
+    {
+        return circle_polygon(circle, polygon);
+    }
+
+    using Test = bool (*)(const Shape &lhs, const Shape &rhs);
+
+    // Indexed by Shape::Type of both shapes
+    const Test tests[Shape::types][Shape::types] = {
+            // AABB, Circle, OrientedBox, Polygon
+            {aabb_aabb,       polygon_circle, polygon_polygon, polygon_polygon},
+            {circle_polygon,  circle_circle,  circle_polygon,  circle_polygon},
+            {polygon_polygon, polygon_circle, polygon_polygon, polygon_polygon},
+            {polygon_polygon, polygon_circle, polygon_polygon, polygon_polygon}
+    };
+}
+
+Shape Shape::aabb(const AABB &box)
+{
+    Shape shape;
+    shape._type = Type::AABB;
+    shape._count = 4;
+    shape._vertices[0] = PointF(box.top_left.x, box.top_left.y);
+    shape._vertices[1] = PointF(box.bottom_right.x, box.top_left.y);
+    shape._vertices[2] = PointF(box.bottom_right.x, box.bottom_right.y);
+    shape._vertices[3] = PointF(box.top_left.x, box.bottom_right.y);
+    return shape;
+}
+
+Shape Shape::circle(const PointF &center, float radius)
+{
+    Shape shape;
+    shape._type = Type::Circle;
+    shape._vertices[0] = center;
+    shape._radius = radius;
+    return shape;
+}
+
+Shape Shape::oriented_box(const PointF &center, const PointF &half_size, float angle)
+{
+    Shape shape;
+    shape._type = Type::OrientedBox;
+    shape._count = 4;
+    auto cos = std::cos(angle);
+    auto sin = std::sin(angle);
+    const PointF corners[4] = {
+            {-half_size.x, -half_size.y},
+            {half_size.x,  -half_size.y},
+            {half_size.x,  half_size.y},
+            {-half_size.x, half_size.y}
+    };
+    for (size_t i = 0; i < 4; ++i)
+    {
+        const auto &corner = corners[i];
+        shape._vertices[i] = PointF(center.x + corner.x * cos - corner.y * sin,
+                                    center.y + corner.x * sin + corner.y * cos);
+    }
+    return shape;
+}
+
+Shape Shape::polygon(const PointF *vertices, size_t count)
+{
+    if (count < 3 || count > max_vertices)
+    {
+        throw std::runtime_error("Polygon should have from 3 to 8 vertices");
+    }
+    Shape shape;
+    shape._type = Type::Polygon;
+    shape._count = count;
+    std::copy(vertices, vertices + count, shape._vertices.begin());
+    float area = 0.f;
+    for (size_t i = 0; i < count; ++i)
+    {
+        area += cross(vertices[i], vertices[(i + 1) % count]);
+    }
+    if (area < 0.f)
+    {
+        std::reverse(shape._vertices.begin(), shape._vertices.begin() + count);
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto &a = shape._vertices[i];
+        const auto &b = shape._vertices[(i + 1) % count];
+        const auto &c = shape._vertices[(i + 2) % count];
+        if (cross(b - a, c - b) < 0.f)
+        {
+            throw std::runtime_error("Polygon should be convex");
+        }
+    }
+    return shape;
+}
+
+Shape::Type Shape::type() const
+{
+    return _type;
+}
+
+AABB Shape::bounds() const
+{
+    PointF min, max;
+    if (_type == Type::Circle)
+    {
+        min = PointF(center().x - _radius, center().y - _radius);
+        max = PointF(center().x + _radius, center().y + _radius);
+    }
+    else
+    {
+        min = max = _vertices[0];
+        for (size_t i = 1; i < _count; ++i)
+        {
+            min = PointF(std::min(min.x, _vertices[i].x), std::min(min.y, _vertices[i].y));
+            max = PointF(std::max(max.x, _vertices[i].x), std::max(max.y, _vertices[i].y));
+        }
+    }
+    auto fit = [](float value)
+    {
+        return (uint32_t) std::clamp<double>(value, 0., std::numeric_limits<uint32_t>::max());
+    };
+    return AABB(fit(std::floor(min.y)), fit(std::floor(min.x)), fit(std::ceil(max.y)), fit(std::ceil(max.x)));
+}
+
+const PointF &Shape::center() const
+{
+    return _vertices[0];
+}
+
+float Shape::radius() const
+{
+    return _radius;
+}
+
+const PointF *Shape::vertices() const
+{
+    return _vertices.data();
+}
+
+size_t Shape::vertices_count() const
+{
+    return _count;
+}
+
+bool core::narrow_phase::intersect(const Shape &lhs, const Shape &rhs)
+{
+    return tests[(size_t) lhs.type()][(size_t) rhs.type()](lhs, rhs);
+}
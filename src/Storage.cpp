@@ -0,0 +1,76 @@
+#include "helpers/Storage.hpp"
+
+#include <new>
+#include <algorithm>
+
+using namespace helpers::storage;
+
+namespace
+{
+    constexpr size_t first_chunk_blocks = 16;
+    constexpr size_t max_chunk_blocks = 1024;
+}
+
+BlockPool::BlockPool(size_t block_size, size_t block_align)
+        :
+        _block_align(std::max(block_align, alignof(FreeBlock)))
+{
+    block_size = std::max(block_size, sizeof(FreeBlock));
+    _block_size = (block_size + _block_align - 1) / _block_align * _block_align;
+}
+
+BlockPool::~BlockPool()
+{
+    for (auto chunk: _chunks)
+    {
+        ::operator delete(chunk, std::align_val_t(_block_align));
+    }
+}
+
+void *BlockPool::allocate()
+{
+    if (_free == nullptr)
+    {
+        // NOTE: chunks grow with the pool, so a big pool is made of a few chunks only
+        add_chunk(std::clamp(_capacity, first_chunk_blocks, max_chunk_blocks));
+    }
+    auto block = _free;
+    _free = block->next;
+    ++_used;
+    return block;
+}
+
+void BlockPool::free(void *block)
+{
+    auto item = static_cast<FreeBlock *>(block);
+    item->next = _free;
+    _free = item;
+    --_used;
+}
+
+void BlockPool::reserve(size_t count)
+{
+    if (count > _capacity)
+    {
+        add_chunk(count - _capacity);
+    }
+}
+
+BlockPool::Stats BlockPool::stats() const
+{
+    return {_block_size, _capacity, _used, _chunks.size()};
+}
+
+void BlockPool::add_chunk(size_t blocks)
+{
+    auto chunk = static_cast<char *>(::operator new(blocks * _block_size, std::align_val_t(_block_align)));
+    _chunks.push_back(chunk);
+    // NOTE: linked backwards, so blocks are handed out in address order
+    for (size_t i = blocks; i-- > 0;)
+    {
+        auto item = reinterpret_cast<FreeBlock *>(chunk + i * _block_size);
+        item->next = _free;
+        _free = item;
+    }
+    _capacity += blocks;
+}
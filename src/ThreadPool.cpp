@@ -0,0 +1,76 @@
+#include "helpers/ThreadPool.h"
+
+using namespace helpers::threading;
+
+ThreadPool::ThreadPool(uint32_t threads)
+{
+    threads = std::max(threads, (uint32_t) 1);
+    _ranges.reset(new Range[threads]);
+    for (uint32_t worker = 1; worker < threads; ++worker)
+    {
+        _threads.emplace_back(&ThreadPool::worker_loop, this, worker);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _start.notify_all();
+    for (auto &thread: _threads)
+    {
+        thread.join();
+    }
+}
+
+uint32_t ThreadPool::size() const
+{
+    return (uint32_t) (_threads.size() + 1);
+}
+
+void ThreadPool::run(const Job &job)
+{
+    if (_threads.empty())
+    {
+        job(0);
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _job = &job;
+        _pending = (uint32_t) _threads.size();
+        ++_generation;
+    }
+    _start.notify_all();
+    job(0);
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _pending == 0; });
+    _job = nullptr;
+}
+
+void ThreadPool::worker_loop(uint32_t worker)
+{
+    uint64_t generation = 0;
+    while (true)
+    {
+        const Job *job = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _start.wait(lock, [&] { return _stop || _generation != generation; });
+            if (_stop)
+            {
+                return;
+            }
+            generation = _generation;
+            job = _job;
+        }
+        (*job)(worker);
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            --_pending;
+        }
+        _done.notify_one();
+    }
+}
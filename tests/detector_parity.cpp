@@ -0,0 +1,447 @@
+// Every detector and option must answer exactly as a brute force search over all objects.
+// Randomized add/update/remove/batch workloads with statics and collision filters; pairs, point and region queries,
+// rays, nearest neighbours and radius queries of every frame are compared.
+// Usage: detector_parity [--seeds N] [--frames N]
+
+#include <array>
+#include <stdexcept>
+#include <initializer_list>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "core/CollisionDetectors.hpp"
+#include "helpers/ThreadPool.h"
+
+namespace
+{
+    using namespace core::basic::behavior;
+    using namespace core::collision_detector;
+
+    struct Object : public virtual UniqueId<Id>, public virtual CollisionShape<AABB>
+    {
+    };
+
+    constexpr uint32_t world = 2000;
+
+    AABB random_box(std::mt19937 &random, uint32_t max_size)
+    {
+        std::uniform_int_distribution<uint32_t> position(0, world - 1);
+        std::uniform_int_distribution<uint32_t> size(1, max_size);
+        uint32_t x = position(random), y = position(random);
+        return AABB(y, x, std::min(world, y + size(random)), std::min(world, x + size(random)));
+    }
+
+    uint64_t distance2(const Point &pt, const AABB &shape)
+    {
+        auto axis = [](uint32_t value, uint32_t low, uint32_t high) -> uint64_t
+        {
+            return value < low ? low - value : (value > high ? value - high : 0);
+        };
+        auto x = axis(pt.x, shape.top_left.x, shape.bottom_right.x);
+        auto y = axis(pt.y, shape.top_left.y, shape.bottom_right.y);
+        return x * x + y * y;
+    }
+
+    // Slab test, the same float math as the detectors use
+    bool intersect(const PointF &origin, const PointF &direction, float length, const AABB &box, float &entry)
+    {
+        float t_min = 0.f;
+        float t_max = length;
+        const float from[2] = {origin.x, origin.y};
+        const float step[2] = {direction.x, direction.y};
+        const float low[2] = {(float) box.top_left.x, (float) box.top_left.y};
+        const float high[2] = {(float) box.bottom_right.x, (float) box.bottom_right.y};
+        for (int axis = 0; axis < 2; ++axis)
+        {
+            if (step[axis] == 0.f)
+            {
+                if (from[axis] < low[axis] || from[axis] > high[axis])
+                {
+                    return false;
+                }
+                continue;
+            }
+            float t1 = (low[axis] - from[axis]) / step[axis];
+            float t2 = (high[axis] - from[axis]) / step[axis];
+            if (t1 > t2)
+            {
+                std::swap(t1, t2);
+            }
+            t_min = std::max(t_min, t1);
+            t_max = std::min(t_max, t2);
+            if (t_min > t_max)
+            {
+                return false;
+            }
+        }
+        entry = t_min;
+        return true;
+    }
+
+    bool accepts(const Object &a, const Object &b)
+    {
+        return (a.collision_layer() & b.collision_mask()) != 0 && (b.collision_layer() & a.collision_mask()) != 0;
+    }
+
+    // Answers of the brute force search over the objects alive
+    class BruteForce
+    {
+    public:
+        explicit BruteForce(const std::vector<std::unique_ptr<Object>> &objects)
+                :
+                _objects(objects)
+        {}
+
+        std::set<std::pair<Id, Id>> pairs() const
+        {
+            std::set<std::pair<Id, Id>> result;
+            for (size_t i = 0; i < _objects.size(); ++i)
+            {
+                for (size_t j = i + 1; j < _objects.size(); ++j)
+                {
+                    const auto &a = *_objects[i];
+                    const auto &b = *_objects[j];
+                    if ((a.is_static_shape() && b.is_static_shape()) || !(a.collision_shape() && b.collision_shape()) ||
+                        !accepts(a, b))
+                    {
+                        continue;
+                    }
+                    result.emplace(std::min(a.unique_id(), b.unique_id()), std::max(a.unique_id(), b.unique_id()));
+                }
+            }
+            return result;
+        }
+
+        std::vector<Id> region(const AABB &roi) const
+        {
+            return select([&](const AABB &shape)
+            { return roi && shape; });
+        }
+
+        std::vector<Id> point(const Point &pt) const
+        {
+            return select([&](const AABB &shape)
+            {
+                return pt.x > shape.top_left.x && pt.x < shape.bottom_right.x &&
+                       pt.y > shape.top_left.y && pt.y < shape.bottom_right.y;
+            });
+        }
+
+        std::vector<Id> radius(const Point &center, uint32_t radius) const
+        {
+            return select([&](const AABB &shape)
+            { return distance2(center, shape) <= (uint64_t) radius * radius; });
+        }
+
+        // (distance, id) of every object, closest first
+        std::vector<std::pair<float, Id>> nearest(const Point &pt) const
+        {
+            std::vector<std::pair<float, Id>> result;
+            for (const auto &object: _objects)
+            {
+                result.emplace_back(std::sqrt((float) distance2(pt, object->collision_shape())), object->unique_id());
+            }
+            std::sort(result.begin(), result.end());
+            return result;
+        }
+
+        // (entry distance, id) of the objects on the segment, closest first
+        std::vector<std::pair<float, Id>> segment(const PointF &from, const PointF &to) const
+        {
+            std::vector<std::pair<float, Id>> result;
+            auto length = std::hypot(to.x - from.x, to.y - from.y);
+            if (length <= 0.f)
+            {
+                return result;
+            }
+            PointF direction((to.x - from.x) / length, (to.y - from.y) / length);
+            for (const auto &object: _objects)
+            {
+                float entry;
+                if (intersect(from, direction, length, object->collision_shape(), entry))
+                {
+                    result.emplace_back(entry, object->unique_id());
+                }
+            }
+            std::sort(result.begin(), result.end());
+            return result;
+        }
+
+    private:
+        template<class Predicate>
+        std::vector<Id> select(Predicate predicate) const
+        {
+            std::vector<Id> result;
+            for (const auto &object: _objects)
+            {
+                if (predicate(object->collision_shape()))
+                {
+                    result.push_back(object->unique_id());
+                }
+            }
+            std::sort(result.begin(), result.end());
+            return result;
+        }
+
+        const std::vector<std::unique_ptr<Object>> &_objects;
+    };
+
+    struct Result
+    {
+        size_t queries{0};
+        size_t mismatches{0};
+    };
+
+    class Checker
+    {
+    public:
+        Checker(const std::string &name, uint32_t seed, Result &result)
+                :
+                _name(name),
+                _seed(seed),
+                _result(result)
+        {}
+
+        void compare(bool same, const char *query, uint32_t frame)
+        {
+            _result.queries++;
+            if (!same)
+            {
+                _result.mismatches++;
+                std::fprintf(stderr, "%s, seed %u, frame %u: %s query differs\n", _name.c_str(), _seed, frame, query);
+            }
+        }
+
+    private:
+        std::string _name;
+        uint32_t _seed;
+        Result &_result;
+    };
+
+    struct Options
+    {
+        // static objects go through add_static() instead of add()
+        bool statics{false};
+    };
+
+    template<class Detector>
+    void compare_queries(Detector &detector, const BruteForce &brute, std::mt19937 &random, Checker &checker,
+                         uint32_t frame)
+    {
+        auto pairs = brute.pairs();
+        checker.compare(detector.broad_check() == pairs, "pair", frame);
+        if (detector.pair_cache())
+        {
+            detector.update_pairs();
+            checker.compare(detector.pairs() == pairs, "cached pair", frame);
+        }
+        typename Detector::IdBuffer found;
+        typename Detector::Neighbours neighbours;
+        typename Detector::RayHits hits;
+        std::uniform_real_distribution<float> coordinate(-50.f, world + 50.f);
+        for (int i = 0; i < 20; ++i)
+        {
+            auto roi = random_box(random, 400);
+            detector.broad_check(roi, found);
+            checker.compare(found == brute.region(roi), "region", frame);
+            Point point(random() % world, random() % world);
+            detector.broad_check(point, found);
+            checker.compare(found == brute.point(point), "point", frame);
+
+            auto radius = random() % 300;
+            detector.radius_check(point, radius, found);
+            checker.compare(found == brute.radius(point, radius), "radius", frame);
+
+            uint32_t k = 1 + random() % 12;
+            detector.nearest(point, k, neighbours);
+            auto all = brute.nearest(point);
+            bool same = neighbours.size() == std::min<size_t>(k, all.size());
+            for (size_t j = 0; same && j < neighbours.size(); ++j)
+            {
+                same = neighbours[j].id == all[j].second && neighbours[j].distance == all[j].first;
+            }
+            checker.compare(same, "nearest", frame);
+
+            // NOTE: axis-aligned segments walk along cell borders, every fifth one is vertical
+            PointF from(coordinate(random), coordinate(random));
+            PointF to(i % 5 == 0 ? from.x : coordinate(random), coordinate(random));
+            detector.segment_cast(from, to, hits);
+            auto expected = brute.segment(from, to);
+            same = hits.size() == expected.size();
+            for (size_t j = 0; same && j < hits.size(); ++j)
+            {
+                same = hits[j].id == expected[j].second && std::abs(hits[j].distance - expected[j].first) < 1e-3f;
+            }
+            checker.compare(same, "ray", frame);
+        }
+    }
+
+    template<class Detector, class Setup>
+    void run(const std::string &name, const Options &options, Setup setup, uint32_t seed, uint32_t frames,
+             Result &result)
+    {
+        std::mt19937 random(seed);
+        Checker checker(name, seed, result);
+        Detector detector;
+        detector.set_world_size({world, world});
+        setup(detector);
+        std::vector<std::unique_ptr<Object>> objects;
+        BruteForce brute(objects);
+        auto make = [&](bool is_static)
+        {
+            auto object = std::make_unique<Object>();
+            object->set_collision_shape(random_box(random, objects.size() % 10 == 0 ? 300 : 30));
+            object->set_static_shape(is_static);
+            // three layers, a quarter of the objects ignore one of them
+            object->set_collision_layer(1u << (objects.size() % 3));
+            if (objects.size() % 4 == 0)
+            {
+                object->set_collision_mask(~(1u << (random() % 3)));
+            }
+            objects.push_back(std::move(object));
+            return objects.back().get();
+        };
+        std::vector<const Object *> statics;
+        for (int i = 0; i < 600; ++i)
+        {
+            auto object = make(i % 7 == 0);
+            if (options.statics && object->is_static_shape())
+            {
+                statics.push_back(object);
+            }
+            else
+            {
+                detector.add(*object);
+            }
+        }
+        detector.add_static(statics);
+        compare_queries(detector, brute, random, checker, 0);
+        for (uint32_t frame = 1; frame <= frames; ++frame)
+        {
+            // NOTE: odd frames update one by one, even frames in one batch; static objects never move
+            std::vector<Id> batch;
+            for (int i = 0; i < 100; ++i)
+            {
+                auto &object = objects[random() % objects.size()];
+                if (object->is_static_shape())
+                {
+                    continue;
+                }
+                object->set_collision_shape(random_box(random, i % 20 == 0 ? 500 : 40));
+                if (i % 10 == 0)
+                {
+                    object->set_collision_mask(object->collision_mask() ^ (1u << (random() % 3)));
+                }
+                if (frame % 2 != 0)
+                {
+                    detector.update(object->unique_id());
+                }
+                else
+                {
+                    batch.push_back(object->unique_id());
+                }
+            }
+            detector.update(batch);
+            for (int i = 0; i < 5; ++i)
+            {
+                auto index = random() % objects.size();
+                detector.remove(*objects[index]);
+                objects.erase(objects.begin() + index);
+            }
+            for (int i = 0; i < 5; ++i)
+            {
+                detector.add(*make(false));
+            }
+            compare_queries(detector, brute, random, checker, frame);
+        }
+    }
+
+    template<class Detector>
+    void run(const std::string &name, const Options &options, uint32_t seed, uint32_t frames, Result &result)
+    {
+        run<Detector>(name, options, [](Detector &)
+        {}, seed, frames, result);
+    }
+
+    template<class Detector>
+    void run_common(const std::string &name, helpers::threading::ThreadPool &pool, uint32_t seed, uint32_t frames,
+                    Result &result)
+    {
+        run<Detector>(name, {}, seed, frames, result);
+        run<Detector>(name + "_statics", {true}, seed, frames, result);
+        run<Detector>(name + "_pool", {}, [&](Detector &detector)
+        {
+            detector.set_thread_pool(&pool);
+        }, seed, frames, result);
+        run<Detector>(name + "_cache", {}, [&](Detector &detector)
+        {
+            detector.set_pair_cache(true);
+        }, seed, frames, result);
+    }
+
+    template<class Grid>
+    void run_grid(const std::string &name, helpers::threading::ThreadPool &pool, uint32_t seed, uint32_t frames,
+                  Result &result)
+    {
+        run_common<Grid>(name, pool, seed, frames, result);
+        run<Grid>(name + "_loose", {}, [](Grid &grid)
+        {
+            grid.set_looseness(2.f);
+        }, seed, frames, result);
+        run<Grid>(name + "_auto_tune", {true}, [](Grid &grid)
+        {
+            grid.set_auto_tune(true);
+        }, seed, frames, result);
+        run<Grid>(name + "_morton", {}, [](Grid &grid)
+        {
+            grid.set_morton_order(1);
+        }, seed, frames, result);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seeds = 2;
+    uint32_t frames = 10;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        auto value = (uint32_t) std::stoul(argv[i + 1]);
+        if (arg == "--seeds")
+        {
+            seeds = value;
+        }
+        else if (arg == "--frames")
+        {
+            frames = value;
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--seeds N] [--frames N]\n", argv[0]);
+            return 1;
+        }
+    }
+    helpers::threading::ThreadPool pool(3);
+    Result result;
+    for (uint32_t seed = 1; seed <= seeds; ++seed)
+    {
+        run_grid<HierarchicalSpatialGrid<Object, CollisionShape, OrderedCell, DenseGrid>>(
+                "grid_ordered_dense", pool, seed, frames, result);
+        run_grid<HierarchicalSpatialGrid<Object, CollisionShape, FlatCell, DenseGrid>>(
+                "grid_flat_dense", pool, seed, frames, result);
+        run_grid<HierarchicalSpatialGrid<Object, CollisionShape, OrderedCell, SparseGrid>>(
+                "grid_ordered_sparse", pool, seed, frames, result);
+        run_grid<HierarchicalSpatialGrid<Object, CollisionShape, FlatCell, SparseGrid>>(
+                "grid_flat_sparse", pool, seed, frames, result);
+        run_common<SweepAndPrune<Object>>("sweep_and_prune", pool, seed, frames, result);
+        run_common<DynamicAABBTree<Object>>("aabb_tree", pool, seed, frames, result);
+    }
+    std::fprintf(stderr, "%zu queries, %zu mismatches\n", result.queries, result.mismatches);
+    return result.mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+// The pair cache must hold exactly the pairs of broad_check(), also when it is enabled after objects were added.
+// Randomized update/remove/add frames for every detector, the cache is re-enabled in the middle of the run.
+// Usage: pair_cache [--seeds N] [--frames N]
+
+#include <array>
+#include <stdexcept>
+#include <initializer_list>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "core/CollisionDetectors.hpp"
+
+namespace
+{
+    using namespace core::basic::behavior;
+    using namespace core::collision_detector;
+
+    struct Object : public virtual UniqueId<Id>, public virtual CollisionShape<AABB>
+    {
+    };
+
+    constexpr uint32_t world = 2000;
+
+    AABB random_box(std::mt19937 &random, uint32_t max_size)
+    {
+        std::uniform_int_distribution<uint32_t> position(0, world - 1);
+        std::uniform_int_distribution<uint32_t> size(1, max_size);
+        uint32_t x = position(random), y = position(random);
+        return AABB(y, x, std::min(world, y + size(random)), std::min(world, x + size(random)));
+    }
+
+    struct Result
+    {
+        size_t checks{0};
+        size_t mismatches{0};
+    };
+
+    template<class Detector>
+    void run(const char *name, uint32_t seed, uint32_t frames, Result &result)
+    {
+        std::mt19937 random(seed);
+        Detector detector;
+        detector.set_world_size({world, world});
+        std::vector<std::unique_ptr<Object>> objects;
+        auto add = [&]()
+        {
+            auto object = std::make_unique<Object>();
+            object->set_collision_shape(random_box(random, objects.size() % 10 == 0 ? 300 : 30));
+            detector.add(*object);
+            objects.push_back(std::move(object));
+        };
+        std::vector<std::unique_ptr<Object>> statics;
+        std::vector<const Object *> loaded;
+        for (int i = 0; i < 100; ++i)
+        {
+            auto object = std::make_unique<Object>();
+            object->set_collision_shape(random_box(random, 60));
+            object->set_static_shape(true);
+            loaded.push_back(object.get());
+            statics.push_back(std::move(object));
+        }
+        detector.add_static(loaded);
+        for (int i = 0; i < 500; ++i)
+        {
+            add();
+        }
+        auto check = [&](uint32_t frame)
+        {
+            detector.update_pairs();
+            result.checks++;
+            if (detector.pairs() != detector.broad_check())
+            {
+                result.mismatches++;
+                std::fprintf(stderr, "%s, seed %u, frame %u: cached pairs differ\n", name, seed, frame);
+            }
+        };
+        // NOTE: everything above was added while the cache was off
+        detector.set_pair_cache(true);
+        check(0);
+        for (uint32_t frame = 1; frame <= frames; ++frame)
+        {
+            for (int i = 0; i < 50; ++i)
+            {
+                auto &object = objects[random() % objects.size()];
+                object->set_collision_shape(random_box(random, i % 20 == 0 ? 500 : 40));
+                detector.update(object->unique_id());
+            }
+            for (int i = 0; i < 5; ++i)
+            {
+                auto index = random() % objects.size();
+                detector.remove(*objects[index]);
+                objects.erase(objects.begin() + index);
+            }
+            for (int i = 0; i < 5; ++i)
+            {
+                add();
+            }
+            if (frame == frames / 2)
+            {
+                detector.set_pair_cache(false);
+                detector.set_pair_cache(true);
+            }
+            check(frame);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seeds = 3;
+    uint32_t frames = 20;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        auto value = (uint32_t) std::stoul(argv[i + 1]);
+        if (arg == "--seeds")
+        {
+            seeds = value;
+        }
+        else if (arg == "--frames")
+        {
+            frames = value;
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--seeds N] [--frames N]\n", argv[0]);
+            return 1;
+        }
+    }
+    Result result;
+    for (uint32_t seed = 1; seed <= seeds; ++seed)
+    {
+        run<HierarchicalSpatialGrid<Object>>("grid", seed, frames, result);
+        run<HierarchicalSpatialGrid<Object, CollisionShape, FlatCell, SparseGrid>>("grid_sparse", seed, frames,
+                                                                                   result);
+        run<SweepAndPrune<Object>>("sweep_and_prune", seed, frames, result);
+        run<DynamicAABBTree<Object>>("aabb_tree", seed, frames, result);
+    }
+    std::fprintf(stderr, "%zu checks, %zu mismatches\n", result.checks, result.mismatches);
+    return result.mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+// DynamicAABBTree must answer region, point and pair queries exactly as HierarchicalSpatialGrid does.
+// Randomized add/update/remove/batch workloads, every query of every frame is compared.
+// Usage: tree_parity [--seeds N] [--frames N]
+
+#include <array>
+#include <stdexcept>
+#include <initializer_list>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "core/CollisionDetectors.hpp"
+
+namespace
+{
+    using namespace core::basic::behavior;
+    using namespace core::collision_detector;
+
+    struct Object : public virtual UniqueId<Id>, public virtual CollisionShape<AABB>
+    {
+    };
+
+    using Grid = HierarchicalSpatialGrid<Object>;
+    using Tree = DynamicAABBTree<Object>;
+
+    constexpr uint32_t world = 2000;
+
+    AABB random_box(std::mt19937 &random, uint32_t max_size)
+    {
+        std::uniform_int_distribution<uint32_t> position(0, world - 1);
+        std::uniform_int_distribution<uint32_t> size(1, max_size);
+        uint32_t x = position(random), y = position(random);
+        return AABB(y, x, std::min(world, y + size(random)), std::min(world, x + size(random)));
+    }
+
+    struct Result
+    {
+        size_t queries{0};
+        size_t mismatches{0};
+    };
+
+    void compare(bool same, const char *query, uint32_t seed, uint32_t frame, Result &result)
+    {
+        result.queries++;
+        if (!same)
+        {
+            result.mismatches++;
+            std::fprintf(stderr, "seed %u, frame %u: %s query differs\n", seed, frame, query);
+        }
+    }
+
+    void run(uint32_t seed, uint32_t frames, Result &result)
+    {
+        std::mt19937 random(seed);
+        Grid grid;
+        Tree tree;
+        grid.set_world_size({world, world});
+        tree.set_world_size({world, world});
+        std::vector<std::unique_ptr<Object>> objects;
+        auto add = [&]()
+        {
+            auto object = std::make_unique<Object>();
+            object->set_collision_shape(random_box(random, objects.size() % 10 == 0 ? 300 : 30));
+            object->set_static_shape(objects.size() % 7 == 0);
+            grid.add(*object);
+            tree.add(*object);
+            objects.push_back(std::move(object));
+        };
+        for (int i = 0; i < 600; ++i)
+        {
+            add();
+        }
+        for (uint32_t frame = 0; frame < frames; ++frame)
+        {
+            // NOTE: odd frames update one by one, even frames in one batch
+            std::vector<Id> batch;
+            for (int i = 0; i < 100 && !objects.empty(); ++i)
+            {
+                auto &object = objects[random() % objects.size()];
+                object->set_collision_shape(random_box(random, i % 20 == 0 ? 500 : 40));
+                grid.update(object->unique_id());
+                if (frame % 2 != 0)
+                {
+                    tree.update(object->unique_id());
+                }
+                else
+                {
+                    batch.push_back(object->unique_id());
+                }
+            }
+            tree.update(batch);
+            for (int i = 0; i < 5 && !objects.empty(); ++i)
+            {
+                auto index = random() % objects.size();
+                grid.remove(*objects[index]);
+                tree.remove(objects[index]->unique_id());
+                objects.erase(objects.begin() + index);
+            }
+            for (int i = 0; i < 5; ++i)
+            {
+                add();
+            }
+            compare(grid.broad_check() == tree.broad_check(), "pair", seed, frame, result);
+            for (int i = 0; i < 50; ++i)
+            {
+                auto roi = random_box(random, 400);
+                compare(grid.broad_check(roi) == tree.broad_check(roi), "region", seed, frame, result);
+                Point point(random() % world, random() % world);
+                compare(grid.broad_check(point) == tree.broad_check(point), "point", seed, frame, result);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seeds = 5;
+    uint32_t frames = 30;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string arg = argv[i];
+        auto value = (uint32_t) std::stoul(argv[i + 1]);
+        if (arg == "--seeds")
+        {
+            seeds = value;
+        }
+        else if (arg == "--frames")
+        {
+            frames = value;
+        }
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--seeds N] [--frames N]\n", argv[0]);
+            return 1;
+        }
+    }
+    Result result;
+    for (uint32_t seed = 1; seed <= seeds; ++seed)
+    {
+        run(seed, frames, result);
+    }
+    std::fprintf(stderr, "%zu queries, %zu mismatches\n", result.queries, result.mismatches);
+    return result.mismatches == 0 ? 0 : 1;
+}